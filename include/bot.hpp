@@ -0,0 +1,84 @@
+#ifndef BOT_HPP_17_10_18_11_47_03
+#define BOT_HPP_17_10_18_11_47_03
+#include <random>
+#include <memory>
+#include <SFML/Network.hpp>
+#include "main.hpp"
+#include "controller.hpp"
+#include "world.hpp"
+
+// how often the bots send their commands (seconds)
+struct BotConfig {
+	float movePeriod = 0.5;
+	float turnPeriod = 0.2;
+	float castPeriod = 3;
+	float reportPeriod = 5;
+};
+
+// headless client for load testing - joins the game, sends scripted commands and measures the traffic
+// (the received updates are decoded into a world that is not simulated or drawn)
+class Bot
+{
+	public:
+		Bot(unsigned index, const BotConfig& config);
+		bool connect(std::string host, unsigned short port);
+		void update(float timeDelta);
+		bool isConnected() const;
+		// prints the statistics for the last period and resets them
+		void report(std::ostream& o, float period);
+
+		struct Stats {
+			u32 updatesReceived = 0;
+			u32 packetsReceived = 0;
+			u32 packetsSent = 0;
+			u64 bytesReceived = 0;
+			u64 bytesSent = 0;
+			u32 rttSamples = 0;
+			float rttSum = 0;
+			float rttMax = 0;
+		};
+		const Stats& getStats() const;
+
+	private:
+		unsigned _index;
+		BotConfig _config;
+		sf::TcpSocket _socket;
+		bool _connected;
+		bool _inGame;
+		std::mt19937 _random;
+		sf::Clock _clock;
+		float _moveTimer;
+		float _turnTimer;
+		float _castTimer;
+		float _yAngle;
+		float _rejoinTimer; // < 0 when not waiting for the next game
+		u32 _nextSeq;
+		std::map<u32, float> _unackedSendTimes; // sequence number -> time sent
+		std::unique_ptr<WorldMap> _map;
+		std::unique_ptr<World> _world;
+		Stats _stats;
+
+		void receive();
+		void handlePacket(sf::Packet& p);
+		void sendCommand(Command& c);
+		void sendPacket(sf::Packet& p);
+		void sendHello();
+		void act(float timeDelta);
+};
+
+////////////////////////////////////////////////////////////
+
+class BotApplication
+{
+	public:
+		BotApplication(unsigned botCount, BotConfig config = BotConfig());
+		// returns the number of connected bots
+		unsigned connect(std::string host, unsigned short port);
+		void run();
+
+	private:
+		BotConfig _config;
+		std::vector<std::unique_ptr<Bot>> _bots;
+};
+
+#endif /* BOT_HPP_17_10_18_11_47_03 */
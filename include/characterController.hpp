@@ -0,0 +1,37 @@
+#ifndef CHARACTERCONTROLLER_HPP_17_10_29_16_02_37
+#define CHARACTERCONTROLLER_HPP_17_10_29_16_02_37
+#include "main.hpp"
+
+// kinematic character - its capsule is swept through the collision world (the terrain, the fence, the trees, the other characters)
+// and slides along what it hits, the slopes steeper than the limit act as walls
+// there are no forces and no friction: the walking velocity follows the input, only the falling is integrated
+// -> the same input in the same world gives the same motion (the client can predict its character with it)
+class CharacterController
+{
+	public:
+		CharacterController();
+		// moves the object (its world transform), walkDir is the horizontal direction in the world space (zero = stand)
+		void step(btCollisionWorld& world, btCollisionObject& object, vec3f walkDir, float gravity, float timeDelta);
+		vec3f getVelocity() const;
+		bool isOnGround() const;
+		// teleported - the velocity and the ground are forgotten
+		void reset();
+		// what the next step depends on besides the position (the client saves it to replay its steps)
+		struct State {
+			vec3f velocity;
+			bool onGround;
+		};
+		State getState() const;
+		void setState(const State& s);
+
+	private:
+		btVector3 _velocity;
+		bool _onGround;
+
+		// moves by the motion, the rest of it after a hit continues along the surface
+		btVector3 slide(btCollisionWorld& world, btCollisionObject& object, btVector3 from, btVector3 motion);
+		// returns the free fraction of the motion (1 = nothing hit) and the normal of the hit surface
+		btScalar sweep(btCollisionWorld& world, btCollisionObject& object, const btVector3& from, const btVector3& to, btVector3& normal);
+};
+
+#endif /* CHARACTERCONTROLLER_HPP_17_10_29_16_02_37 */
@@ -6,6 +6,8 @@
 #include "system.hpp"
 #include "keyValueStore.hpp"
 #include "timedFilter.hpp"
+#include "inputPredictor.hpp"
+#include "networkStats.hpp"
 #include "gui.hpp"
 
 class Animator: public Observer<EntityEvent>
@@ -35,15 +37,19 @@ class ClientApplication
 		void run();
 		void startGame();
 		void createCamera();
+		// network statistics are printed with this period (0 = never)
+		void setStatsDumpPeriod(float seconds);
 		
 	private:
 		sf::TcpSocket _server;
 		unique_ptr<IrrlichtDevice, void(*)(IrrlichtDevice*)> _device;
 		Controller _controller;
 		unique_ptr<WorldMap> _worldMap;
+		float _physicsStep; // of the server (from GameInit), 0 = the default of Physics
 		unique_ptr<World> _gameWorld;
 		unique_ptr<ViewSystem> _vs;
 		unique_ptr<Physics> _physics;
+		unique_ptr<ProjectileSystem> _projectiles;
 		unique_ptr<GUI> _gui;
 		Animator _animator;
 		KeyValueStore _sharedRegistry;
@@ -51,6 +57,14 @@ class ClientApplication
 		float _cameraElevation;
 		float _cameraYAngle;
 		TimedFilter<float> _yAngleSetCommandFilter;
+		InputPredictor _predictor;
+		sf::Clock _clock;
+		ClockOffsetEstimator _serverClock;
+		// remote entities are rendered this much (seconds) behind the estimated server time
+		float _interpolationDelay;
+		NetworkStats _networkStats;
+		float _statsDumpPeriod;
+		float _statsDumpTimer;
 
 		void commandHandler(Command& c);
 		void sendCommand(Command& c);
@@ -61,6 +75,9 @@ class ClientApplication
 		void sendHello();
 		void displayMessage(std::string message);
 		scene::ICameraSceneNode* getCamera();
+		BodyComponent* getControlledBody();
+		// server time at which the remote entities are rendered
+		float getRenderTime();
 };
 
 #endif /* CLIENT_HPP_16_11_26_10_46_45 */
@@ -16,12 +16,18 @@ class Command
 			ROT_DIR_SET,			// i32: -1 = left, 0 = stop, 1 = right
 			ROT_diff,         // vec2f: rotation difference in radians
 			Y_ANGLE_SET,      // float: Y rotation angle in radians
-			STR,							// command and data in one string
+			CAST,             // u32: index of the incantation (in the list the client defined at join)
+			LAUNCH_SPELL,     // float: elevation in degrees (-90 - 90)
+			SAY,              // string: chat message
+			SET_NAME,         // string: name of the character
 		};
 
 		Command(Type type = Type::Null);
+		Command(const Command& other);
+		Command& operator=(const Command& other);
 
 		Type _type;
+		u32 _seq; // sequence number of a client-predicted command (0 = not predicted)
 		union {
 			vec2f _vec2f;
 			vec3f _vec3f;
@@ -30,7 +36,7 @@ class Command
 			u32 _u32;
 			i64 _i64;
 		};
-		std::string _str;
+		std::string _str; // SAY and SET_NAME only
 };
 
 ////////////////////////////////////////////////////////////
@@ -51,10 +57,14 @@ class Controller: public IEventReceiver
 		bool isCameraFree();
 		void setDevice(IrrlichtDevice* dev);
 		const KeyValueStore& getSettings() const;
+		// all the incantations the controller can cast, the index is sent in Command::CAST
+		const std::vector<std::string>& getIncantations() const;
 
 	private:
+		u32 internIncantation(const std::string& incantation);
+
 		IrrlichtDevice* _device;
-		typedef std::map<std::string, std::vector<std::string>> SpellBook;
+		typedef std::map<std::string, std::vector<u32>> SpellBook; // spell name -> incantations
 		typedef std::map<irr::EKEY_CODE, std::string> KeyMap;
 		bool _keyPressed[KEY_KEY_CODES_COUNT];
 		bool _LMBdown;
@@ -64,6 +74,8 @@ class Controller: public IEventReceiver
 		GetScreenSize _getScreenSize;
 		Exit _exit;
 		SpellBook _spellBook;
+		std::vector<std::string> _incantations;
+		std::map<std::string, u32> _incantationIndices;
 		KeyMap _keyMap;
 		bool _freeCamera;
 		KeyValueStore _settings;
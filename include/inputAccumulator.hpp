@@ -0,0 +1,34 @@
+#ifndef INPUTACCUMULATOR_HPP_17_10_27_09_14_40
+#define INPUTACCUMULATOR_HPP_17_10_27_09_14_40
+#include <vector>
+#include <functional>
+#include "controller.hpp"
+
+// merges the commands of one player received within one tick, they are applied once at the start of the tick
+// in the order they came, the state commands (strafe direction, rotation, Y angle) between two one-shot commands
+// keep only their last value (a spell is launched with the angle it was aimed with),
+// the one-shot commands (spells, name, ...) are kept up to a limit - a flood costs no more than that
+class InputAccumulator
+{
+	public:
+		InputAccumulator(std::size_t maxOneShots = 16);
+		// returns false if the command was dropped
+		bool add(const Command& c);
+		void flush(std::function<void(Command& c)> apply);
+		void clear();
+		// since the last call
+		u32 takeMergedC();
+		u32 takeDroppedC();
+
+	private:
+		std::size_t _maxOneShots;
+		std::vector<Command> _commands;
+		std::size_t _lastOneShot; // index in _commands + 1 (0 = none), the state commands after it are merged
+		std::size_t _oneShotC;
+		u32 _mergedC;
+		u32 _droppedC;
+
+		static bool isState(Command::Type t);
+};
+
+#endif /* INPUTACCUMULATOR_HPP_17_10_27_09_14_40 */
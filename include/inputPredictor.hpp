@@ -0,0 +1,52 @@
+#ifndef INPUTPREDICTOR_HPP_17_06_12_18_20_41
+#define INPUTPREDICTOR_HPP_17_06_12_18_20_41
+#include <deque>
+#include "main.hpp"
+#include "controller.hpp"
+#include "world.hpp"
+#include "characterController.hpp"
+
+class Physics;
+
+// applies movement commands of the controlled character immediately (the client physics then moves it)
+// and keeps them, with the physics steps they were moved by, until the server acknowledges them
+// when an authoritative body state arrives, the character is put there and the steps the server has not simulated yet
+// are replayed with the unacknowledged commands (the character controller is deterministic)
+class InputPredictor
+{
+	public:
+		InputPredictor();
+		// returns false if the command does not affect movement and was not predicted
+		bool predict(Command& c, BodyComponent* bc);
+		// the server applied the commands up to seq at the start of its tick at serverTime
+		void acknowledge(u32 seq, float serverTime);
+		// after each physics update which simulated something, state is the controller state before the update
+		void addFrame(const CharacterController::State& state, float simulatedTime);
+		// body already contains the authoritative state of serverTime
+		void reconcile(BodyComponent& bc, float serverTime, Physics& physics, ID character);
+		void reset();
+		std::size_t getPendingCount() const;
+
+	private:
+		// Command is not copyable (union with non-trivial members), keep just the movement part
+		struct PendingInput {
+			u32 seq;
+			Command::Type type;
+			vec2f strafeDir;
+			float yAngle;
+		};
+		std::deque<PendingInput> _pending;
+		struct Frame {
+			u32 seq; // the last command predicted before the frame
+			float time; // simulated
+			CharacterController::State state; // at the start
+		};
+		std::deque<Frame> _frames;
+		u32 _nextSeq;
+		u32 _lastAckedSeq;
+		float _lastAckTime; // server time
+
+		static void apply(const PendingInput& i, BodyComponent& bc);
+};
+
+#endif /* INPUTPREDICTOR_HPP_17_06_12_18_20_41 */
@@ -2,9 +2,9 @@
 #define KEYVALUESTORE_HPP_17_06_22_19_18_42 
 #include <map>
 #include <cassert>
-#include "serializable.hpp"
+#include <string>
 
-class KeyValueStore : public Serializable {
+class KeyValueStore {
 	public:
 		virtual ~KeyValueStore();
 
@@ -12,6 +12,7 @@ class KeyValueStore : public Serializable {
 		virtual void addPair(std::string key, std::string value);
 
 		bool hasKey(std::string key) const;
+		bool isString(const std::string& key) const;
 
 		template <typename T>
 		T getValue(std::string key) const
@@ -23,7 +24,16 @@ class KeyValueStore : public Serializable {
 		virtual void setValue(std::string key, float value);
 		virtual void setValue(std::string key, std::string value);
 
-		virtual void serDes(SerDesBase& s);
+		// f(const std::string& key, float value), f(const std::string& key, const std::string& value)
+		template <typename FloatF, typename StringF>
+		void forEachPair(FloatF floatF, StringF stringF) const
+		{
+			for(auto& p : _store)
+				floatF(p.first, p.second);
+			for(auto& p : _strStore)
+				stringF(p.first, p.second);
+		}
+
 		template <typename T>
 			void doSerDes(T& t)
 			{
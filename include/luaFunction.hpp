@@ -0,0 +1,69 @@
+#ifndef LUAFUNCTION_HPP_17_10_31_10_22_48
+#define LUAFUNCTION_HPP_17_10_31_10_22_48
+#include <string>
+#include <type_traits>
+#include "main.hpp"
+
+// a global function of a script looked up once (kept in the registry) and called with typed arguments
+// the reference holds the function the global had when resolved - assigning the global later does not change it
+// the failed calls are counted, only the first error of the function is printed
+class LuaFunction
+{
+	public:
+		LuaFunction(const char* name);
+		LuaFunction(const LuaFunction&) = delete;
+		LuaFunction& operator=(const LuaFunction&) = delete;
+		// returns false (and calls do nothing) if the global is not a function
+		bool resolve(lua_State* L);
+		// must be called before the state is closed (the destructor does not touch the state)
+		void release();
+		bool isResolved() const;
+
+		// returns false if the function is not resolved or if it failed
+		template <typename... Args>
+		bool operator()(const Args&... args) {
+			if(!isResolved())
+				return false;
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, _ref);
+			int dummy[] = {0, (push(_L, args), 0)...};
+			(void)dummy;
+			return call(sizeof...(Args));
+		}
+
+		// since the last call
+		u32 takeFailureC();
+
+	private:
+		std::string _name;
+		lua_State* _L;
+		int _ref;
+		u32 _failureC;
+		bool _reported;
+
+		bool call(int argc);
+
+		static void push(lua_State* L, bool v) {
+			lua_pushboolean(L, v);
+		}
+		template <typename T>
+		static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type push(lua_State* L, T v) {
+			lua_pushinteger(L, lua_Integer(v));
+		}
+		template <typename T>
+		static typename std::enable_if<std::is_floating_point<T>::value>::type push(lua_State* L, T v) {
+			lua_pushnumber(L, v);
+		}
+		static void push(lua_State* L, const char* v) {
+			lua_pushstring(L, v);
+		}
+		static void push(lua_State* L, const std::string& v) {
+			lua_pushlstring(L, v.data(), v.size());
+		}
+		// anything else is pushed by the callable: void f(lua_State* L) leaving one value on the stack
+		template <typename F>
+		static auto push(lua_State* L, const F& f) -> decltype(f(L), void()) {
+			f(L);
+		}
+};
+
+#endif /* LUAFUNCTION_HPP_17_10_31_10_22_48 */
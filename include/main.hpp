@@ -7,6 +7,7 @@
 #include <functional>
 #include <map>
 #include <cassert>
+#include <mutex>
 #include "config.hpp"
 
 #ifndef MAIN_HPP_16_11_18_13_20_24
@@ -68,6 +69,9 @@ class ImageDumper {
 		inline bool operator()(std::string fileName, PixValGetter pixVal, irr::core::vector2d<unsigned> imSize) const
 		{
 			using namespace irr;
+			// maps are generated by the room threads at the same time
+			static std::mutex m;
+			std::lock_guard<std::mutex> l(m);
 			auto im = _driver->createImage(video::ECF_R8G8B8, core::dimension2du(imSize));
 			for(unsigned y = 0; y < imSize.Y; ++y)
 				for(unsigned x = 0; x < imSize.X; ++x) {
@@ -88,6 +92,15 @@ std::ostream& operator<<(std::ostream& o, std::vector<T> v) {
 	o << std::endl;
 }
 
+template <typename K, typename V>
+std::ostream& operator <<(std::ostream& o, const std::pair<K,V>& p) {
+	return o << p.first << ": " << p.second << "; ";
+}
+template <typename K, typename V>
+std::ostream& operator >>(std::ostream& /*o*/, std::pair<K,V>& /*p*/) {
+	assert(false); //TODO
+}
+
 template <typename K, typename V>
 std::ostream& operator <<(std::ostream& t, const std::map<K,V>& m) {
 	t << static_cast<u32>(m.size());
@@ -101,15 +114,6 @@ std::ostream& operator >>(std::ostream& /*t*/, std::map<K,V>& /*m*/) {
 	assert(false); //TODO
 }
 
-template <typename K, typename V>
-std::ostream& operator <<(std::ostream& o, const std::pair<K,V>& p) {
-	return o << p.first << ": " << p.second << "; ";
-}
-template <typename K, typename V>
-std::ostream& operator >>(std::ostream& /*o*/, std::pair<K,V>& /*p*/) {
-	assert(false); //TODO
-}
-
 float lerp(float a, float b, float m);
 
 extern ImageDumper SAVEIMAGE;
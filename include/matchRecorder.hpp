@@ -0,0 +1,85 @@
+#ifndef MATCHRECORDER_HPP_17_10_21_10_32_17
+#define MATCHRECORDER_HPP_17_10_21_10_32_17
+#include <fstream>
+#include <memory>
+#include <SFML/Network.hpp>
+#include "main.hpp"
+#include "controller.hpp"
+#include "world.hpp"
+
+class Game;
+
+// everything a Game gets from the outside, in the order it got it
+// the file is a sequence of records, each is a sf::Packet prefixed by its size
+enum class MatchRecord: u8
+{
+	Map,          // WorldMap - starts a new game
+	Tick,         // float timeDelta of Game::run
+	PlayerJoined, // ID of the created character
+	PlayerLeft,   // ID of the removed character
+	PlayerCommand, // u32 tick, ID entity, Command
+	Incantation   // std::string - defined by a player, commands cast it by the ID it got
+};
+
+class MatchRecorder
+{
+	public:
+		bool open(std::string fileName);
+		void map(const WorldMap& m);
+		void tick(float timeDelta);
+		void playerJoined(ID character);
+		void playerLeft(ID character);
+		void command(const Command& c, ID entity);
+		void incantation(const std::string& incantation);
+
+	private:
+		std::ofstream _file;
+		u32 _tick;
+		sf::Packet _packet; // reused for all the records
+
+		void write();
+};
+
+////////////////////////////////////////////////////////////
+
+// drives Games from a recording as fast as possible, no sockets and no Updater
+// (a benchmark of Physics, SpellSystem and the gamemode on a real workload)
+class MatchReplay
+{
+	public:
+		MatchReplay();
+		~MatchReplay();
+		bool open(std::string fileName);
+		// returns false if the recording is malformed
+		bool run();
+		// replay with another physics step than the server's - to compare the tick cost (the replay may diverge)
+		void setPhysicsStep(float seconds);
+		void setPhysicsMaxSteps(unsigned steps);
+
+	private:
+		std::ifstream _file;
+		WorldMap _map;
+		std::unique_ptr<Game> _game;
+
+		struct Stats {
+			u32 ticks = 0;
+			u32 commands = 0;
+			float simulatedTime = 0;
+			float tickTime = 0; // real time spent in Game::run
+			float maxTickTime = 0;
+			float physicsTime = 0; // real time spent in Physics::update
+			float droppedTime = 0; // not simulated by the physics (over its budget)
+		};
+		Stats _gameStats;
+		Stats _totalStats;
+		u32 _gameC;
+		float _physicsStep; // 0 = the default of Physics
+		int _physicsMaxSteps; // -1 = the default of Physics
+
+		bool read(sf::Packet& p);
+		void startGame();
+		void endGame();
+		void report(std::ostream& o, std::string name, const Stats& s);
+};
+
+#endif /* MATCHRECORDER_HPP_17_10_21_10_32_17 */
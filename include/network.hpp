@@ -1,6 +1,8 @@
 #include <main.hpp>
 #include <SFML/Network.hpp>
 #include <world.hpp>
+#include <wireBuffer.hpp>
+#include <deque>
 
 #ifndef NETWORK_HPP_16_11_27_11_45_29
 #define NETWORK_HPP_16_11_27_11_45_29 
@@ -12,10 +14,18 @@ enum PacketType: u8
 	RegistryUpdate,
 	GameRegistryUpdate,
 	JoinGame,
-	GameInit,
+	GameInit,        // game server -> client: WorldMap, float physics step (seconds) - the client predicts its character with the same step
 	GameOver,
 	ClientHello,
 	Message,
+	WorldSnapshot,
+	InputAck,        // game server -> client: u32 seq of the last command applied, float server time of the tick which applied it
+	Spectate,        // relay -> game server instead of ClientHello: u16 version major, u16 minor, std::string key, u16 room
+	Redirect,        // router -> client: std::string address, u16 port of the game server to connect to
+	BackendRegister, // game server -> router: std::string address (empty = the one it connects from), u16 port
+	BackendLoad,     // game server -> router: u32 players, float tick time
+	DefineIncantations, // client -> game server after GameInit: std::vector<std::string>, Command::CAST refers to them by index
+	PacketTypeCount // keep last
 };
 
 /*
@@ -71,6 +81,47 @@ sf::Packet& operator >>(sf::Packet& packet, Command::Type& m);
 sf::Packet& operator <<(sf::Packet& packet, const irr::scene::ESCENE_NODE_TYPE& m);
 sf::Packet& operator >>(sf::Packet& packet, irr::scene::ESCENE_NODE_TYPE& m);
 
+std::string toString(PacketType t);
+std::string toString(ComponentType t);
+
+// packet type of a framed packet and the component type if it is a WorldUpdate (NONE otherwise)
+// (for statistics - the packet is not decoded)
+PacketType peekPacketType(const WireBuffer& b);
+ComponentType peekUpdatedComponentType(const WireBuffer& b);
+
+// pool of the buffers in which the packets are queued for sending
+BufferPool& getSharedBufferPool();
+// the packet as the socket would send it (size + data)
+WireBuffer framePacket(sf::Packet& packet);
+// the framed packet decoded back (for the packets which are forwarded)
+void unframePacket(const WireBuffer& b, sf::Packet& packet);
+
+// framed packets waiting for a non-blocking socket, sent in order
+class SendQueue
+{
+	public:
+		SendQueue(std::size_t maxBytes = 4*1024*1024);
+		// returns false if the queue would grow over maxBytes (the receiver does not read its data)
+		bool push(const WireBuffer& b);
+		// sends as much as the socket accepts, returns false if the socket is disconnected or failed
+		bool flush(sf::TcpSocket& s);
+		std::size_t size() const;
+		void swap(SendQueue& other);
+
+	private:
+		std::deque<WireBuffer> _queue;
+		std::size_t _offset; // bytes of the first buffer already sent
+		std::size_t _queuedBytes;
+		std::size_t _maxBytes;
+};
+
+// full state of all entities and their components (sent to a client which joins a running game)
+// returns the number of written entities
+u32 writeWorldSnapshot(sf::Packet& packet, World& world);
+void readWorldSnapshot(sf::Packet& packet, World& world);
+// applies a WorldUpdate (without the PacketType) as it is (no prediction or interpolation), returns its event
+EntityEvent readWorldUpdate(sf::Packet& packet, World& world);
+
 template <typename T, typename K, typename V>
 T& operator <<(T& t, const std::map<K,V>& m) {
 	t << static_cast<u32>(m.size());
@@ -106,6 +157,7 @@ T& operator<<(T& t, const std::vector<TT>& v)
 	t << u32(v.size());
 	for(const auto& e : v)
 		t << e;
+	return t;
 }
 template <typename T, typename TT>
 T& operator>>(T& t, std::vector<TT>& v)
@@ -113,11 +165,12 @@ T& operator>>(T& t, std::vector<TT>& v)
 	v.clear();
 	u32 size;
 	t >> size;
-	v.reserve(size);
+	// no reserve - the size may come from a peer
 	for(u32 i = 0; i < size; i++) {
 		TT e;
 		t >> e;
 		v.push_back(e);
 	}
+	return t;
 }
 #endif /* NETWORK_HPP_16_11_27_11_45_29 */
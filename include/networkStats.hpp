@@ -0,0 +1,54 @@
+#ifndef NETWORKSTATS_HPP_17_10_19_20_13_55
+#define NETWORKSTATS_HPP_17_10_19_20_13_55
+#include <array>
+#include <functional>
+#include "network.hpp"
+
+// traffic counters per packet type and per replicated component type
+// kept in one second buckets for the last 10 seconds
+class NetworkStats
+{
+	public:
+		struct Counter {
+			u64 packets = 0;
+			u64 bytes = 0;
+		};
+
+		NetworkStats();
+		// updated is the component type of a WorldUpdate
+		void packetSent(PacketType t, std::size_t bytes, ComponentType updated = ComponentType::NONE);
+		void packetReceived(PacketType t, std::size_t bytes, ComponentType updated = ComponentType::NONE);
+		void sendQueueDepth(std::size_t buffers);
+		void encodeTime(float seconds);
+		// moves the window
+		void update(float timeDelta);
+		// all the sent/received traffic in the last (up to 10) seconds
+		Counter getSent(unsigned seconds) const;
+		Counter getReceived(unsigned seconds) const;
+		// 1 s and 10 s rates of the non-zero counters
+		void dump(std::ostream& o, std::string name) const;
+
+	private:
+		static const unsigned WINDOW = 10;
+		struct Bucket {
+			std::array<Counter, PacketTypeCount> sent;
+			std::array<Counter, PacketTypeCount> received;
+			std::array<Counter, ComponentType::LAST> componentsSent;
+			std::array<Counter, ComponentType::LAST> componentsReceived;
+			std::size_t maxSendQueueDepth = 0;
+			float encodeTime = 0;
+			u32 encodeC = 0;
+		};
+		// ring of the finished buckets + the current one
+		std::array<Bucket, WINDOW+1> _buckets;
+		unsigned _current;
+		unsigned _finishedC;
+		float _bucketTime;
+
+		using CounterGetter = std::function<Counter(const Bucket& b)>;
+		// sum over the last finished buckets, returns the number of summed buckets
+		unsigned sum(unsigned seconds, CounterGetter get, Counter& total) const;
+		void dumpCounter(std::ostream& o, std::string what, CounterGetter get) const;
+};
+
+#endif /* NETWORKSTATS_HPP_17_10_19_20_13_55 */
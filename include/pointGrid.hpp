@@ -0,0 +1,201 @@
+#ifndef POINTGRID_HPP_17_10_30_11_47_03
+#define POINTGRID_HPP_17_10_30_11_47_03
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+// points identified by small integer keys (the key is an index) in a uniform grid over X and Z
+// updated incrementally - moving a point within its cell costs just the store of the coordinates
+// the distances are 3D
+template <typename K>
+class PointGrid {
+	public:
+		PointGrid(float cellSize = 4): _cellSize{cellSize}, _size{0}
+		{}
+
+		// inserts or moves the point
+		void set(K key, float x, float y, float z) {
+			if(key >= _points.size())
+				_points.resize(std::size_t(key)+1);
+			Point& p = _points[key];
+			std::int64_t cell = cellKey(x, z);
+			if(p.present && p.cell != cell)
+				unlink(key);
+			if(!p.present || p.cell != cell) {
+				std::vector<K>& c = _cells[cell];
+				p.cell = cell;
+				p.slot = c.size();
+				c.push_back(key);
+				if(!p.present)
+					++_size;
+				p.present = true;
+			}
+			p.x = x;
+			p.y = y;
+			p.z = z;
+		}
+
+		void remove(K key) {
+			if(!contains(key))
+				return;
+			unlink(key);
+			_points[key].present = false;
+			--_size;
+		}
+
+		bool contains(K key) const {
+			return key < _points.size() && _points[key].present;
+		}
+
+		void clear() {
+			for(auto& c : _cells)
+				c.second.clear();
+			_points.clear();
+			_size = 0;
+		}
+
+		std::size_t size() const {
+			return _size;
+		}
+
+		// f(K key, float distanceSQ) for every point within the radius
+		// (nothing for a negative or NaN radius or position)
+		template <typename F>
+		void queryRadius(float x, float y, float z, float radius, F f) const {
+			if(!(radius >= 0) || std::isnan(x) || std::isnan(y) || std::isnan(z))
+				return;
+			float rSQ = radius*radius;
+			double span = 2.*radius/_cellSize + 2;
+			if(span*span > _cells.size()) {
+				// the range has more cells than there are, every point is tested
+				for(auto& c : _cells)
+					for(K key : c.second) {
+						float dSQ = distanceSQ(_points[key], x, y, z);
+						if(dSQ <= rSQ)
+							f(key, dSQ);
+					}
+				return;
+			}
+			std::int32_t x0 = cellCoord(x - radius), x1 = cellCoord(x + radius);
+			std::int32_t z0 = cellCoord(z - radius), z1 = cellCoord(z + radius);
+			for(std::int32_t cz = z0; cz <= z1; ++cz)
+				for(std::int32_t cx = x0; cx <= x1; ++cx) {
+					auto c = _cells.find(cellKey(cx, cz));
+					if(c == _cells.end())
+						continue;
+					for(K key : c->second) {
+						float dSQ = distanceSQ(_points[key], x, y, z);
+						if(dSQ <= rSQ)
+							f(key, dSQ);
+					}
+				}
+		}
+
+		// appends the keys of (at most) k nearest points accepted by the filter (bool filter(K key)), the closest first
+		// searches the rings of cells around the point until the k-th candidate is closer than any unsearched cell
+		// (or tests every point once the rings cover more cells than there are - a point far away from the others)
+		template <typename F>
+		void nearest(float x, float y, float z, std::size_t k, F filter, std::vector<K>& out) const {
+			if(k == 0 || std::isnan(x) || std::isnan(y) || std::isnan(z))
+				return;
+			std::vector<std::pair<float, K>> found;
+			std::int32_t cx = cellCoord(x), cz = cellCoord(z);
+			std::size_t visited = 0;
+			for(std::int32_t d = 0; visited < _size; ++d) {
+				if(double(2*d+1)*(2*d+1) > _cells.size()) {
+					found.clear();
+					for(auto& c : _cells)
+						for(K key : c.second)
+							if(filter(key))
+								found.push_back(std::make_pair(distanceSQ(_points[key], x, y, z), key));
+					break;
+				}
+				forRing(cx, cz, d, [&](const std::vector<K>& cell) {
+						for(K key : cell) {
+							++visited;
+							if(filter(key))
+								found.push_back(std::make_pair(distanceSQ(_points[key], x, y, z), key));
+						}
+					});
+				// the point may lie at the border of its cell
+				float reach = d*_cellSize;
+				if(found.size() >= k) {
+					std::nth_element(found.begin(), found.begin()+k-1, found.end());
+					if(found[k-1].first <= reach*reach)
+						break;
+				}
+			}
+			std::sort(found.begin(), found.end());
+			if(found.size() > k)
+				found.resize(k);
+			for(auto& f : found)
+				out.push_back(f.second);
+		}
+
+	private:
+		struct Point {
+			float x, y, z;
+			std::int64_t cell;
+			std::uint32_t slot; // index in the cell
+			bool present = false;
+		};
+
+		float _cellSize;
+		std::vector<Point> _points; // indexed by the key
+		std::size_t _size;
+		std::unordered_map<std::int64_t, std::vector<K>> _cells;
+
+		// clamped - the coordinates of the queries come from the scripts
+		std::int32_t cellCoord(float v) const {
+			const float limit = 1 << 30;
+			return std::max(-limit, std::min(limit, std::floor(v/_cellSize)));
+		}
+
+		std::int64_t cellKey(float x, float z) const {
+			return cellKey(cellCoord(x), cellCoord(z));
+		}
+
+		static std::int64_t cellKey(std::int32_t cx, std::int32_t cz) {
+			return (std::int64_t(cx) << 32) | std::uint32_t(cz);
+		}
+
+		static float distanceSQ(const Point& p, float x, float y, float z) {
+			return (p.x-x)*(p.x-x) + (p.y-y)*(p.y-y) + (p.z-z)*(p.z-z);
+		}
+
+		void unlink(K key) {
+			Point& p = _points[key];
+			std::vector<K>& c = _cells[p.cell];
+			K last = c.back();
+			c[p.slot] = last;
+			_points[last].slot = p.slot;
+			c.pop_back();
+		}
+
+		// the cells at the Chebyshev distance d from (cx, cz)
+		template <typename F>
+		void forRing(std::int32_t cx, std::int32_t cz, std::int32_t d, F f) const {
+			auto visit = [&](std::int32_t x, std::int32_t z) {
+				auto c = _cells.find(cellKey(x, z));
+				if(c != _cells.end())
+					f(c->second);
+			};
+			if(d == 0) {
+				visit(cx, cz);
+				return;
+			}
+			for(std::int32_t x = cx-d; x <= cx+d; ++x) {
+				visit(x, cz-d);
+				visit(x, cz+d);
+			}
+			for(std::int32_t z = cz-d+1; z <= cz+d-1; ++z) {
+				visit(cx-d, z);
+				visit(cx+d, z);
+			}
+		}
+};
+
+#endif /* POINTGRID_HPP_17_10_30_11_47_03 */
@@ -0,0 +1,70 @@
+#ifndef RELAY_HPP_17_10_25_12_06_51
+#define RELAY_HPP_17_10_25_12_06_51
+#include <memory>
+#include <deque>
+#include <SFML/Network.hpp>
+#include "main.hpp"
+#include "world.hpp"
+#include "network.hpp"
+#include "networkStats.hpp"
+
+// fan-out for spectators - subscribes to a game server once (as a privileged spectator)
+// and re-broadcasts the received game to any number of spectator clients, optionally delayed
+// the relay keeps its own copy of the (delayed) world to give the joining spectators a snapshot
+class RelayApplication
+{
+	public:
+		RelayApplication(float delay = 0);
+		bool connect(std::string host, unsigned short port, std::string key, u16 room = 0);
+		bool listen(unsigned short port);
+		void run();
+		// network statistics are printed with this period (0 = never)
+		void setStatsDumpPeriod(float seconds);
+
+	private:
+		struct Spectator {
+			std::unique_ptr<sf::TcpSocket> socket;
+			SendQueue sendQueue;
+			bool watching = false; // said hello and got the snapshot
+			bool closed = false;
+		};
+		// a received packet waiting for its release time
+		struct Delayed {
+			float releaseTime;
+			WireBuffer buffer;
+		};
+
+		sf::TcpSocket _upstream;
+		std::string _host;
+		unsigned short _port;
+		std::string _key;
+		u16 _room;
+		bool _connected;
+		float _reconnectTimer;
+
+		sf::TcpListener _listener;
+		std::vector<Spectator> _spectators;
+		float _delay;
+		float _time;
+		std::deque<Delayed> _delayed;
+
+		// the game as the spectators see it (with the delay)
+		std::unique_ptr<WorldMap> _map;
+		std::unique_ptr<World> _world;
+		WireBuffer _gameInit;
+		WireBuffer _gameRegistry;
+
+		NetworkStats _networkStats; // upstream traffic and the packets broadcast to the spectators (once for all)
+		float _statsDumpPeriod;
+		float _statsDumpTimer;
+
+		bool subscribe();
+		void receiveUpstream();
+		void release();
+		void handleSpectator(Spectator& s);
+		void startWatching(Spectator& s);
+		void send(Spectator& s, const WireBuffer& b);
+		void broadcast(const WireBuffer& b);
+};
+
+#endif /* RELAY_HPP_17_10_25_12_06_51 */
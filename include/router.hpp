@@ -0,0 +1,47 @@
+#ifndef ROUTER_HPP_17_10_23_17_41_08
+#define ROUTER_HPP_17_10_23_17_41_08
+#include <memory>
+#include <SFML/Network.hpp>
+#include "main.hpp"
+#include "network.hpp"
+
+// lobby of a cluster of game server processes
+// clients connect here first and are redirected to the least loaded backend (before they join a game),
+// backends register over the control socket and report their load periodically
+class RouterApplication
+{
+	public:
+		RouterApplication();
+		bool listen(unsigned short clientPort, unsigned short controlPort);
+		void run();
+
+	private:
+		struct Backend {
+			std::unique_ptr<sf::TcpSocket> socket;
+			bool registered = false;
+			std::string address;
+			u16 port = 0;
+			u32 players = 0;
+			float tickTime = 0;
+		};
+		struct Client {
+			std::unique_ptr<sf::TcpSocket> socket;
+			float waitTime = 0;
+		};
+
+		sf::TcpListener _clientListener;
+		sf::TcpListener _controlListener;
+		std::vector<Backend> _backends;
+		std::vector<Client> _clients;
+		// clients which do not say hello in time are disconnected
+		float _helloTimeout;
+
+		void accept();
+		// return false when the connection should be dropped
+		bool handleClient(Client& c, float timeDelta);
+		bool handleBackend(Backend& b);
+		Backend* chooseBackend();
+		void sendAndDisconnect(sf::TcpSocket& s, sf::Packet& p);
+};
+
+#endif /* ROUTER_HPP_17_10_23_17_41_08 */
@@ -1,115 +1,179 @@
 #include <world.hpp>
+#include <wire.hpp>
 
 #ifndef SERDES_HPP_16_12_02_11_12_45
-#define SERDES_HPP_16_12_02_11_12_45 
+#define SERDES_HPP_16_12_02_11_12_45
+
 template <typename T>
-class Serializer: public SerDesBase
-{
+struct WirePod<irr::core::vector2d<T>>: WirePod<T>
+{};
+template <typename T>
+struct WirePod<irr::core::vector3d<T>>: WirePod<T>
+{};
+template <>
+struct WirePod<quaternion>: std::true_type
+{};
+
+// prints the fields (debugging)
+class WirePrinter {
 	public:
-		Serializer(Serializable& s): _s{s}
+		static const bool reading = false;
+
+		WirePrinter(std::ostream& o): _o(o)
 		{}
-		Serializer<T>& operator >>(T& t)
-		{
-			_t = &t;
-			_s.serDes(*this);
-			return *this;
-		}
+
 		template <typename DT>
 			void operator&(const DT& d)
 			{
-				*_t << d;// << " | ";
+				_o << d << " | ";
 			}
-		virtual void serDes(BodyComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(GraphicsComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(SphereGraphicsComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(MeshGraphicsComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(ParticleSystemGraphicsComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(CollisionComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(AttributeStoreComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(WizardComponent& s) {
-			s.doSerDes(*this);
-		}
 
-		virtual void serDes(KeyValueStore& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(WorldMap& s) {
-			s.doSer(*this);
+	private:
+		std::ostream& _o;
+};
+
+////////////////////////////////////////////////////////////
+
+// encoding of a component class - components are serialized through a base class pointer,
+// the functions are picked by the component type
+struct ComponentCodec {
+	std::size_t (*size)(ObservableComponentBase& c);
+	void (*encode)(ObservableComponentBase& c, char* out);
+	bool (*decode)(ObservableComponentBase& c, const char* data, std::size_t size);
+	void (*print)(ObservableComponentBase& c, std::ostream& o);
+};
+
+ComponentCodec& getComponentCodec(ComponentType t);
+
+template <typename ComponentClass>
+void registerComponentCodec(ComponentType t)
+{
+	ComponentCodec& codec = getComponentCodec(t);
+	// registered by the first World (before the rooms start their threads), the others would race the readers
+	if(codec.size)
+		return;
+	codec.size = [](ObservableComponentBase& c) {
+		WireSizer s;
+		static_cast<ComponentClass&>(c).doSerDes(s);
+		return s.size();
+	};
+	codec.encode = [](ObservableComponentBase& c, char* out) {
+		WireWriter w(out);
+		static_cast<ComponentClass&>(c).doSerDes(w);
+	};
+	codec.decode = [](ObservableComponentBase& c, const char* data, std::size_t size) {
+		WireReader r(data, size);
+		static_cast<ComponentClass&>(c).doSerDes(r);
+		return r.ok() && r.atEnd();
+	};
+	codec.print = [](ObservableComponentBase& c, std::ostream& o) {
+		WirePrinter p(o);
+		static_cast<ComponentClass&>(c).doSerDes(p);
+	};
+}
+
+// encoding buffer reused by all serializations on the thread
+inline std::string& getWireScratchBuffer()
+{
+	static thread_local std::string buffer;
+	return buffer;
+}
+
+////////////////////////////////////////////////////////////
+
+// objects are written to streams as a single length-prefixed blob
+template <typename Stream, typename S>
+void wireWrite(Stream& t, S& o)
+{
+	WireSizer s;
+	o.doSerDes(s);
+	std::string& b = getWireScratchBuffer();
+	b.resize(s.size());
+	WireWriter w(&b[0]);
+	o.doSerDes(w);
+	t << b;
+}
+
+template <typename S>
+void wireWrite(std::ostream& t, S& o)
+{
+	WirePrinter p(t);
+	o.doSerDes(p);
+}
+
+template <typename Stream>
+void wireWrite(Stream& t, ObservableComponentBase& c)
+{
+	ComponentCodec& codec = getComponentCodec(c.getComponentType());
+	std::string& b = getWireScratchBuffer();
+	b.resize(codec.size(c));
+	codec.encode(c, &b[0]);
+	t << b;
+}
+
+inline void wireWrite(std::ostream& t, ObservableComponentBase& c)
+{
+	getComponentCodec(c.getComponentType()).print(c, t);
+}
+
+template <typename Stream, typename S>
+void wireRead(Stream& t, S& o)
+{
+	std::string& b = getWireScratchBuffer();
+	t >> b;
+	WireReader r(b.data(), b.size());
+	o.doSerDes(r);
+	if(!r.ok())
+		std::cerr << "Failed to deserialize " << typeid(S).name() << ": not enough data.\n";
+}
+
+template <typename Stream>
+void wireRead(Stream& t, ObservableComponentBase& c)
+{
+	std::string& b = getWireScratchBuffer();
+	t >> b;
+	if(!getComponentCodec(c.getComponentType()).decode(c, b.data(), b.size()))
+		std::cerr << "Failed to deserialize component of type " << int(c.getComponentType()) << ": malformed data.\n";
+}
+
+////////////////////////////////////////////////////////////
+
+template <typename T>
+class Serializer
+{
+	public:
+		template <typename S>
+		Serializer(S& s): _s{&s}, _write{[](T& t, void* s) { wireWrite(t, *static_cast<S*>(s)); }}
+		{}
+		Serializer<T>& operator >>(T& t)
+		{
+			_write(t, _s);
+			return *this;
 		}
 
 	private:
-		Serializable& _s;
-		T* _t;
+		void* _s;
+		void (*_write)(T& t, void* s);
 };
 
 ////////////////////////////////////////////////////////////
 
 template <typename T>
-class Deserializer: public SerDesBase
+class Deserializer
 {
 	public:
-		Deserializer(Serializable& s): _s{s}
+		template <typename S>
+		Deserializer(S& s): _s{&s}, _read{[](T& t, void* s) { wireRead(t, *static_cast<S*>(s)); }}
 		{}
 		Deserializer<T>& operator <<(T& t)
 		{
-			_t = &t;
-			_s.serDes(*this);
+			_read(t, _s);
 			return *this;
 		}
-		template <typename DT>
-			void operator&(DT& d)
-			{
-				*_t >> d;
-			}
-		virtual void serDes(BodyComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(GraphicsComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(SphereGraphicsComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(MeshGraphicsComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(ParticleSystemGraphicsComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(CollisionComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(AttributeStoreComponent& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(WizardComponent& s) {
-			s.doSerDes(*this);
-		}
-
-		virtual void serDes(KeyValueStore& s) {
-			s.doSerDes(*this);
-		}
-		virtual void serDes(WorldMap& s) {
-			s.doDes(*this);
-		}
 
 	private:
-		Serializable& _s;
-		T* _t;
+		void* _s;
+		void (*_read)(T& t, void* s);
 };
 
 template <typename T>
@@ -135,10 +199,4 @@ T& operator >>(T& t, Deserializer<T>&& m)
 {
 	return operator>>(t,m);
 }
-
-template <> template <typename DT>
-void Serializer<std::ostream>::operator&(const DT& d)
-{
-	*_t << d << " | ";
-}
 #endif /* SERDES_HPP_16_12_02_11_12_45 */
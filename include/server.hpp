@@ -8,12 +8,23 @@
 #include "keyValueStore.hpp"
 #include "observableKeyValueStore.hpp"
 #include "network.hpp"
+#include "networkStats.hpp"
+#include "matchRecorder.hpp"
+#include "inputAccumulator.hpp"
 #include <queue>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <random>
 
 #ifndef SERVER_HPP_16_11_26_09_22_02
 #define SERVER_HPP_16_11_26_09_22_02 
 using ClientFilterPredicate = function<bool(ID e)>; 
 
+class Room;
+
 class Game: public Observabler<EntityEvent>
 {
 	public:
@@ -26,9 +37,23 @@ class Game: public Observabler<EntityEvent>
 		void removeCharacter(ID entityID);
 		Entity* getWorldEntity(ID eID);
 		void handlePlayerCommand(Command& c, ID entity);
+		// returns the ID to cast the incantation with (Command::CAST)
+		u32 defineIncantation(const std::string& incantation);
+		// SpellSystem::NO_INCANTATION if not defined yet
+		u32 findIncantation(const std::string& incantation) const;
 		using Store = ObservableKeyValueStore<PacketType,PacketType::GameRegistryUpdate>;
 		Store& getRegistry();
 		const WorldMap& getMap() const;
+		u32 writeSnapshot(sf::Packet& p);
+		// the inputs of the game are recorded from now on (nullptr = stop recording)
+		void setRecorder(MatchRecorder* recorder);
+		// see Physics::setStepSize, Physics::setMaxSteps
+		void setPhysicsStep(float seconds);
+		float getPhysicsStep() const;
+		void setPhysicsMaxSteps(unsigned steps);
+		Physics::Stats takePhysicsStats();
+		// the failed calls of the spell and gamemode script functions since the last call
+		u32 takeScriptFailureC();
 
 	private:
 		void loadMap();
@@ -38,14 +63,23 @@ class Game: public Observabler<EntityEvent>
 		void gameModeOnPlayerJoined(ID character);
 		void gameModeOnPlayerLeft(ID character);
 		void gameModeOnGameStart();
+		std::vector<LuaFunction*> gameModeFunctions();
 
 		const WorldMap& _map;
 		World _gameWorld;
+		SpatialIndex _spatialIndex;
+		AttributeIndex _attributeIndex;
 		Physics _physics;
+		ProjectileSystem _projectiles;
 		SpellSystem _spells;
 		InputSystem _input;
 		lua_State* _LuaStateGameMode;
+		LuaFunction _gmOnPlayerJoined;
+		LuaFunction _gmOnPlayerLeft;
+		LuaFunction _gmOnGameStart;
+		LuaFunction _gmOnEntityEvent;
 		std::queue<EntityEvent> _eventQueue;
+		std::vector<Contact> _contacts;
 		Store _registry;
 
 		class GameModeEntityEventObserver: public Observer<EntityEvent> {
@@ -57,6 +91,8 @@ class Game: public Observabler<EntityEvent>
 		};
 		GameModeEntityEventObserver _gameModeEntityEventObserver;
 		bool _ended;
+		MatchRecorder* _recorder;
+		std::mt19937 _random; // math.random of the gamemode, seeded by the map
 };
 
 ////////////////////////////////////////////////////////////
@@ -69,8 +105,8 @@ class Session: public Observer<KeyValueStoreChange<PacketType>>
 
 	public:
 		using GameJoinRequestHandler = std::function<bool(Session& s)>;
-		using Broadcaster = std::function<void(sf::Packet& p, ClientFilterPredicate fp)>;
-		Session(unique_ptr<sf::TcpSocket>&& socket, GameJoinRequestHandler h, Broadcaster b);
+		// connection is unique for the whole run of the server (session IDs are reused)
+		Session(unique_ptr<sf::TcpSocket>&& socket, u32 connection, GameJoinRequestHandler h);
 		Session(const Session&) = delete;
 		Session& operator=(const Session&) = delete;
 		Session(Session&&);
@@ -82,32 +118,49 @@ class Session: public Observer<KeyValueStoreChange<PacketType>>
 		bool receive();
 		void send(sf::Packet& p);
 		void send(PacketType t);
+		// queues the buffer (shared with other sessions) and sends as much as the socket accepts
+		void send(const WireBuffer& b);
+		// continues sending of the queued data
+		void flushSendQueue();
+		std::size_t getSendQueueSize() const;
+		NetworkStats& getStats();
 		bool isClosed();
 		template <typename T>
 		void setValue(std::string key, T value);
 		virtual void onMsg(const MessageT& m) final;
-		void joinGame(Game& game);
-		void leaveGame();
+		void joinRoom(Room& room);
+		void leaveRoom();
+		// the room has ended the game of this session
+		void onRoomLeft();
+		Room* getRoom() const;
+		u32 getConnection() const;
+		// spectators get all the updates of a room but control no character
+		bool isSpectator() const;
+		const std::string& getSpectatorKey() const;
+		u16 getSpectatedRoom() const;
 		ID getControlledObjID() const;
+		void setControlledObjID(ID id);
 		std::string getRemoteAddress() const;
 
 	private:
 		Session();
-		Game* _game;
+		Room* _room;
+		u32 _connection;
 		Store _sharedRegistry;
 		GameJoinRequestHandler _requestGameJoin;
-		Broadcaster _broadcast;
 		unique_ptr<sf::TcpSocket> _socket;
 		void handlePacket(sf::Packet& p);
 		bool _closed;
 		bool _authorized;
+		SendQueue _sendQueue;
+		NetworkStats _stats;
+		bool _spectator;
+		std::string _spectatorKey;
+		u16 _spectatedRoom;
 
 		void addPair(std::string key, float value);
 		void disconnectUnauthorized(std::string reason = "Unauthorized.");
 		void onAuthorized();
-		void sendMap(const WorldMap& map);
-
-		void setControlledObjID(ID id);
 };
 
 void swap(Session& lhs, Session& rhs);
@@ -124,18 +177,122 @@ class Updater: public Observer<EntityEvent>
 	public:
 		using Sender = function<void(sf::Packet& p, ClientFilterPredicate fp)>;
 		using EntityResolver = function<Entity*(ID entID)>;
-		Updater(Sender s, EntityResolver getEntity);
+		Updater(Sender s, EntityResolver getEntity, float updatePeriod = 0.01);
 		void tick(float delta);
+		// the server time of the updates sent by the last tick
+		float getTime() const;
 		void onMsg(const EntityEvent& m) final;
 		void reset();
+		// minimal time between two batches of component updates (created/destroyed events are sent immediately)
+		void setUpdatePeriod(float seconds);
 
 	private:
 		Sender _send;
 		EntityResolver _getEntity;
 		std::unordered_set<EntityEvent> _updateEventQueue;
 		float _timeSinceLastUpdateSent;
+		float _updatePeriod;
+		float _time; // server time written to the updates (clients interpolate by it)
+
+		// last sent state of bodies - kinematic ones are extrapolated by the clients (dead reckoning),
+		// so their updates are sent only when they differ from the extrapolation too much
+		struct SentBodyState {
+			float time;
+			vec3f position;
+			vec3f velocity;
+		};
+		std::map<ID, SentBodyState> _sentBodyStates;
+		float _deadReckoningThreshold;
+		sf::Packet _packet; // reused for all the updates
 
 		void sendEvent(const EntityEvent&);
+		bool isPredictedByClients(const EntityEvent&);
+};
+
+////////////////////////////////////////////////////////////
+
+// one independent match (its own Game, Updater and map) running on its own thread
+// sessions talk to the room only by posting tasks, the room answers by deliveries
+// which are sent to the sessions by the main thread
+class Room: public Observer<KeyValueStoreChange<PacketType>>
+{
+	public:
+		using Task = std::function<void(Room& r)>;
+		using SessionCallback = std::function<void(Session& s)>;
+		// data for one session (connection) produced by the room
+		struct Delivery {
+			u32 connection;
+			WireBuffer buffer; // may be empty
+			SessionCallback apply; // called before the buffer is sent (may be empty)
+		};
+
+		Room(unsigned index);
+		~Room();
+		Room(const Room&) = delete;
+		Room& operator=(const Room&) = delete;
+		void start();
+		void stop();
+		// thread safe, the task is run on the room thread before its next tick
+		void post(Task t);
+		// thread safe, moves out the deliveries produced since the last call
+		void takeDeliveries(std::vector<Delivery>& out);
+		unsigned getIndex() const;
+		// thread safe, smoothed real time of one tick (seconds)
+		float getTickTime() const;
+
+		// call before start
+		void setUpdatePeriod(float seconds);
+		void setStatsDumpPeriod(float seconds);
+		void setPhysicsStep(float seconds);
+		void setPhysicsMaxSteps(unsigned steps);
+		bool record(std::string fileName);
+
+		// room thread only
+		void join(u32 connection, bool spectator = false);
+		void leave(u32 connection);
+		void command(u32 connection, Command& c);
+		void say(u32 connection, std::string msg);
+		void defineIncantations(u32 connection, const std::vector<std::string>& incantations);
+		virtual void onMsg(const KeyValueStoreChange<PacketType>& m) final;
+
+	private:
+		unsigned _index;
+		WorldMap _map;
+		std::unique_ptr<Game> _game;
+		Updater _updater;
+		NetworkStats _networkStats; // packets encoded for broadcast (once for all the members)
+		float _statsDumpPeriod;
+		float _statsDumpTimer;
+		float _physicsStep; // 0 = the default of Physics
+		int _physicsMaxSteps; // -1 = the default of Physics
+		MatchRecorder _recorder;
+		struct Member {
+			ID character; // NULLID for spectators
+			std::vector<u32> incantations; // index in the client's list -> ID in the game
+			InputAccumulator input; // applied at the start of the next tick
+			u32 addedIncantationC = 0; // new to the game, limited by MEMBER_INCANTATION_SHARE
+			u32 lastInputSeq = 0; // of the predicted commands, acknowledged when applied
+			u32 ackedInputSeq = 0;
+		};
+		std::map<u32, Member> _members; // connection -> member
+
+		std::thread _thread;
+		std::atomic<bool> _running;
+		std::atomic<float> _tickTime;
+		std::mutex _mutex; // guards the tasks and the deliveries
+		std::vector<Task> _tasks;
+		std::vector<Task> _runningTasks;
+		std::vector<Delivery> _deliveries;
+
+		void run();
+		void applyInputs();
+		void send(u32 connection, sf::Packet& p, SessionCallback apply = SessionCallback());
+		void deliver(u32 connection, WireBuffer b, SessionCallback apply = SessionCallback());
+		void broadcast(sf::Packet& p, ClientFilterPredicate fp);
+		void sendSnapshot(u32 connection);
+		void gameOver();
+		void newGame();
+		void dumpStats();
 };
 
 ////////////////////////////////////////////////////////////
@@ -143,28 +300,50 @@ class Updater: public Observer<EntityEvent>
 class ServerApplication
 {
 	public:
-		ServerApplication(IrrlichtDevice* irrDev);
+		ServerApplication(IrrlichtDevice* irrDev, unsigned roomCount = 1);
 		bool listen(short port);
 		void run();
 		~ServerApplication();
 		bool requestGameJoin(Session& s);
+		void setUpdatePeriod(float seconds);
+		// network statistics are printed with this period (0 = never)
+		void setStatsDumpPeriod(float seconds);
+		// fixed time step of the physics of all the rooms (seconds)
+		void setPhysicsStep(float seconds);
+		// at most this many physics steps per tick (0 = unlimited), see Physics::setMaxSteps
+		void setPhysicsMaxSteps(unsigned steps);
+		// records the games for a replay (see MatchReplay), every room to its own file
+		bool record(std::string fileName);
+		// offers this server to the clients of a router (see RouterApplication)
+		// advertisedAddress is where the clients connect to (empty = the address seen by the router)
+		bool registerAtRouter(std::string host, unsigned short controlPort, std::string advertisedAddress, unsigned short port);
+		// relays which know the key may spectate (see RelayApplication), empty = nobody
+		void setSpectatorKey(std::string key);
 
 	private:
 		void acceptClient();
 		void onClientConnect(unique_ptr<sf::TcpSocket>&& s);
 		void onClientDisconnect(ID sessionID);
-		void broadcast(sf::Packet& p, ClientFilterPredicate fp);
-		void gameOver();
-		void newGame();
+		void deliver();
 
 		sf::TcpListener _listener;
-		SolidVector<Session,ID,NULLID> _sessions;
 		IrrlichtDevice* _irrDevice;
+		// the rooms have to outlive the sessions (sessions post their leave to them)
+		std::vector<std::unique_ptr<Room>> _rooms;
+		SolidVector<Session,ID,NULLID> _sessions;
+		std::unordered_map<u32, ID> _connections; // connection -> session ID
+		u32 _nextConnection;
+		std::vector<Room::Delivery> _deliveries; // reused for all the rooms
 
-		WorldMap _map;
-		std::unique_ptr<Game> _game;
+		float _statsDumpPeriod;
+		float _statsDumpTimer;
+		sf::TcpSocket _router;
+		bool _routerConnected;
+		float _loadReportTimer;
+		std::string _spectatorKey;
 
-		Updater _updater;
+		void dumpStats();
+		void reportLoad();
 };
 
 #endif /* SERVER_HPP_16_11_26_09_22_02 */
@@ -0,0 +1,138 @@
+#ifndef SNAPSHOTBUFFER_HPP_17_10_03_16_52_07
+#define SNAPSHOTBUFFER_HPP_17_10_03_16_52_07
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cassert>
+
+// last few timestamped states of one object
+// (times are expected to be increasing, older samples are overwritten when full)
+template <typename T>
+class SnapshotBuffer {
+	public:
+		// f is in [0,1] when interpolating, > 1 when extrapolating
+		using Interpolator = std::function<T(const T& a, const T& b, float f)>;
+
+		SnapshotBuffer(unsigned capacity = 16): _capacity{capacity}, _first{0}
+		{
+			assert(capacity >= 2);
+			_store.reserve(capacity);
+		}
+
+		// returns false if the sample is older than the newest one (reordered) and was dropped
+		bool push(float time, const T& state) {
+			if(!empty() && time <= newestTime())
+				return false;
+			Sample s{time, state};
+			if(size() < _capacity)
+				_store.push_back(s);
+			else {
+				_store[_first] = s;
+				advance(_first);
+			}
+			return true;
+		}
+
+		// state at the given time
+		// between two samples it is interpolated, after the newest one it is extrapolated from the last two
+		// for at most maxExtrapolation seconds, before the oldest one the oldest state is returned
+		// returns false if there is no sample
+		bool sample(float time, T& out, float maxExtrapolation, const Interpolator& interpolate) const {
+			if(empty())
+				return false;
+			if(size() == 1 || time <= at(0).time) {
+				out = (time <= at(0).time ? at(0) : at(size()-1)).state;
+				return true;
+			}
+			unsigned i = 1;
+			while(i < size()-1 && at(i).time < time)
+				i++;
+			const Sample& a = at(i-1);
+			const Sample& b = at(i);
+			if(time > b.time)
+				time = std::min(time, b.time+maxExtrapolation);
+			out = interpolate(a.state, b.state, (time-a.time)/(b.time-a.time));
+			return true;
+		}
+
+		float newestTime() const {
+			assert(!empty());
+			return at(size()-1).time;
+		}
+
+		float oldestTime() const {
+			assert(!empty());
+			return at(0).time;
+		}
+
+		bool empty() const {
+			return _store.empty();
+		}
+
+		unsigned size() const {
+			return _store.size();
+		}
+
+		void clear() {
+			_store.clear();
+			_first = 0;
+		}
+
+	private:
+		struct Sample {
+			float time;
+			T state;
+		};
+		std::vector<Sample> _store;
+		unsigned _capacity;
+		unsigned _first;
+
+		// i-th oldest sample
+		const Sample& at(unsigned i) const {
+			return _store[(_first+i)%_capacity];
+		}
+
+		void advance(unsigned& i) const {
+			i = (i+1)%_capacity;
+		}
+};
+
+////////////////////////////////////////////////////////////
+
+// estimates the difference between a remote clock (server) and the local one
+// from timestamps of received packets
+// the least delayed packet gives the best estimate -> jump to greater offsets immediately
+// and follow smaller ones (growing latency, clock drift) slowly
+class ClockOffsetEstimator {
+	public:
+		ClockOffsetEstimator(float adaptRate = 0.02f): _adaptRate{adaptRate}, _offset{0}, _hasEstimate{false}
+		{}
+
+		void addSample(float remoteTime, float localTime) {
+			float o = remoteTime - localTime;
+			if(!_hasEstimate || o > _offset)
+				_offset = o;
+			else
+				_offset += (o-_offset)*_adaptRate;
+			_hasEstimate = true;
+		}
+
+		float toRemote(float localTime) const {
+			return localTime + _offset;
+		}
+
+		bool hasEstimate() const {
+			return _hasEstimate;
+		}
+
+		void reset() {
+			_offset = 0;
+			_hasEstimate = false;
+		}
+
+	private:
+		float _adaptRate;
+		float _offset;
+		bool _hasEstimate;
+};
+#endif /* SNAPSHOTBUFFER_HPP_17_10_03_16_52_07 */
@@ -1,10 +1,20 @@
 #ifndef SYSTEM_HPP_17_01_29_09_08_12
 #define SYSTEM_HPP_17_01_29_09_08_12 
 #include <map>
+#include <cmath>
+#include <set>
+#include <unordered_map>
+#include <tuple>
 #include <bullet/btBulletDynamicsCommon.h>
 #include <bullet/BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
 #include "world.hpp"
 #include "observer.hpp"
+#include "snapshotBuffer.hpp"
+#include "pointGrid.hpp"
+#include "characterController.hpp"
+#include "luaFunction.hpp"
+
+class MyMotionState;
 
 class System: public Observer<EntityEvent>
 {
@@ -16,32 +26,163 @@ class System: public Observer<EntityEvent>
 		World& _world;
 };
 
+enum class ContactState: u8
+{
+	Begin,   // the pair started touching in this update
+	Persist, // touched in the previous update too
+	End,     // touched in the previous update, not any more
+};
+
+// each touching pair once per update, first < second
+struct Contact {
+	ID first;
+	ID second;
+	ContactState state;
+};
+
 class Physics: public System
 {
 	public:
 		Physics(World& world, scene::ISceneManager* smgr = nullptr);
+		~Physics();
 		vec3f getObjVelocity(ID objID);
 		virtual void update(float timeDelta);
 		virtual void onMsg(const EntityEvent& m);
-		void registerCollisionCallback(std::function<void(ID, ID)> callback);
-		void registerPairCollisionCallback(std::function<void(ID, ID)> callback);
+		// called once per update with all the contacts (if there are any)
+		void registerContactCallback(std::function<void(const std::vector<Contact>&)> callback);
+		// fixed time step of the simulation (seconds), the update runs as many steps as fit in its time
+		void setStepSize(float seconds);
+		float getStepSize() const;
+		// at most this many steps per update (0 = unlimited) - after a stall the steps get coarser
+		// and if it is still not enough, the rest of the time is dropped (the game slows down)
+		void setMaxSteps(unsigned steps);
+		// the time the last update simulated (the steps done, without the dropped time and the remainder of a step)
+		// - the other systems advance by it to stay in step with the characters
+		float getSimulatedTime() const;
+
+		// the client prediction (InputPredictor) replays the steps of its character:
+		// false if the entity is not a character
+		bool getCharacterState(ID objID, CharacterController::State& state);
+		// puts the character where its body component is, with the controller state
+		void resetCharacter(ID objID, const CharacterController::State& state);
+		// moves the character alone, in the steps update would use for the time
+		void stepCharacter(ID objID, float timeDelta);
+		struct Stats {
+			u32 updates = 0;
+			u32 steps = 0;
+			u32 coarseSteps = 0; // longer than the step size (over the budget)
+			float droppedTime = 0; // not simulated (seconds)
+			float time = 0; // real time spent in the updates (seconds)
+			float maxTime = 0; // of one update
+		};
+		// returns the stats since the last call
+		Stats takeStats();
 
 	private:
+		// the bodies with mass (characters) are kinematic, moved by their controllers - Bullet only detects the contacts
+		// the others are static
 		unique_ptr<btDiscreteDynamicsWorld> _physicsWorld;
-		struct ObjData {
-			float walkTimer = 0;
-			bool onGround = false;
+		// entity <-> rigid body, the body's user index is the entity ID
+		struct Binding {
+			btRigidBody* body = nullptr;
+			MyMotionState* motionState = nullptr; // holds the component handles of the entity
+			bool character = false;
+			CharacterController controller;
+		};
+		std::vector<Binding> _bindings; // indexed by entity ID
+		std::vector<Binding> _bodyPool; // released bodies (out of the world), reinitialized when reused
+		enum class ShapeType: u8 {
+			Capsule,
 		};
-		std::map<ID, ObjData> _objData;
-		std::vector<std::function<void(ID, ID)>> _collCallbacks;
+		using ShapeKey = std::tuple<ShapeType, float, float>; // type, radius, height
+		std::map<ShapeKey, std::unique_ptr<btCollisionShape>> _shapes; // shared by all the bodies of the same dimensions
+		std::vector<std::function<void(const std::vector<Contact>&)>> _contactCallbacks;
+		std::vector<std::pair<ID, ID>> _touching; // sorted pairs touching in the last update
+		std::vector<std::pair<ID, ID>> _touchingNow;
+		std::vector<Contact> _contacts;
 		float _tAcc;
+		float _stepSize;
+		unsigned _maxSteps;
+		float _simulatedTime;
+		Stats _stats;
 		bool _updating;
 		std::unique_ptr<float[]> _heightMap;
 
-		btCollisionObject* getCollisionObjectByID(ID objID);
-		void bodyDoStrafe(float timeDelta);
-		void moveKinematics(float timeDelta);
-		void callCollisionCBs();
+		btRigidBody* getBodyByID(ID objID);
+		Binding* getBinding(ID objID);
+		void bindBody(ID objID, btRigidBody* body, MyMotionState* motionState, bool character);
+		void unbindBody(ID objID);
+		btCollisionShape* getShape(ShapeType type, float radius, float height);
+		void createBody(ID objID, BodyComponent& bc, CollisionComponent& cc);
+		// in place, the body leaves and enters the world only when its broadphase class or shape changes
+		void updateBody(Binding& b, CollisionComponent& cc, bool resetTransform);
+		// parameters which do not need the body to be out of the world
+		void setupBody(btRigidBody* body, CollisionComponent& cc);
+		// the component storage moves when components are added or removed,
+		// the handles are resolved at the start of each update (nothing is added or removed while stepping)
+		void refreshComponentHandles();
+		void moveCharacters(float timeDelta);
+		void moveCharacter(Binding& b, float timeDelta);
+		void collectContacts();
+};
+
+// the kinematic bodies (spells) - no dynamic response is needed, so they are not in Bullet
+// they live in packed arrays, are moved by their velocity and their paths (swept spheres) are tested against
+// the terrain, the map border and the collision capsules of the other bodies (their centers indexed by a PointGrid)
+class ProjectileSystem: public System
+{
+	public:
+		ProjectileSystem(World& world);
+		virtual void update(float timeDelta);
+		virtual void onMsg(const EntityEvent& m);
+		// called once per update with the contacts of the projectiles (if there are any)
+		// the terrain is ObjStaticID::Map, the border of the map is NULLID
+		// (the contacts are tested only when there is a callback)
+		void registerContactCallback(std::function<void(const std::vector<Contact>&)> callback);
+		std::size_t getProjectileC() const;
+
+	private:
+		// projectiles, the arrays are parallel (removed by swapping with the last)
+		std::vector<ID> _ids;
+		std::vector<vec3f> _positions;
+		std::vector<vec3f> _velocities;
+		std::vector<float> _radii;
+		std::vector<u16> _layers;
+		std::vector<u16> _masks;
+		std::vector<BodyComponent*> _bodies; // resolved at the start of each update
+		std::vector<u32> _slots; // entity ID -> index in the arrays + 1 (0 = not a projectile)
+		std::vector<vec3f> _previousPositions; // before the integration, the start of the sweeps
+
+		// the non-kinematic bodies the projectiles can hit
+		// kept up to date by the events, the characters (dynamic) are also refreshed before each sweep
+		struct Capsule {
+			ID entity;
+			vec3f a, b; // the axis
+			float radius;
+			u16 layer;
+			u16 mask;
+			bool dynamic;
+		};
+		std::vector<Capsule> _capsules; // removed by swapping with the last
+		std::vector<u32> _colliderSlots; // entity ID -> index in _capsules + 1 (0 = not a collider)
+		std::vector<ID> _dynamicColliders;
+		PointGrid<ID> _grid; // the centers of the capsules
+		float _capsuleReach; // the largest distance of a capsule point from its center
+
+		std::vector<std::function<void(const std::vector<Contact>&)>> _contactCallbacks;
+		std::vector<std::pair<ID, ID>> _touching;
+		std::vector<std::pair<ID, ID>> _touchingNow;
+		std::vector<Contact> _contacts;
+		bool _updating;
+
+		void add(ID entityID, BodyComponent& bc, CollisionComponent& cc);
+		void remove(ID entityID);
+		void setCollider(ID entityID, BodyComponent& bc, CollisionComponent& cc);
+		void removeCollider(ID entityID);
+		void refreshDynamicColliders();
+		std::vector<float> _cuts; // of the path at the cell borders of the heightmap, kept for its memory
+		void sweep(std::size_t i, vec3f from, vec3f to);
+		bool sweepTerrain(const Terrain& terrain, vec3f from, vec3f to, float r);
 };
 
 class ViewSystem: public System
@@ -51,10 +192,20 @@ class ViewSystem: public System
 		~ViewSystem();
 		virtual void onMsg(const EntityEvent& m);
 		virtual void update(float timeDelta);
+		// authoritative body state of a remote entity sampled by the server at serverTime
+		void addNetworkSample(ID entityID, float serverTime, const BodyComponent& bc);
+		// server time to render - entities with network samples are interpolated to it
+		void setRenderTime(float serverTime);
 
 	private:
 		irr::scene::ISceneManager* _smgr;
 		std::set<ID> _transformedEntities;
+		struct BodyState {
+			vec3f position;
+			quaternion rotation;
+		};
+		std::map<ID, SnapshotBuffer<BodyState>> _networkSamples;
+		float _renderTime;
 		
 		void spotObjects();
 		void onObjectLookAt(scene::ISceneNode* sn);
@@ -66,23 +217,111 @@ class ViewSystem: public System
 		void loadTerrain();
 };
 
+// positions of the entities with a body, kept up to date by the body events
+// (observe the world directly to see the positions set within a tick)
+class SpatialIndex: public System
+{
+	public:
+		SpatialIndex(World& world, float cellSize = 4);
+		virtual void onMsg(const EntityEvent& m);
+		// componentMask - bits 1<<ComponentType, the entities must have all of them (0 = any entity)
+		std::vector<ID> getEntitiesInRadius(vec3f center, float radius, u32 componentMask = 0);
+		// at most k, the closest first
+		std::vector<ID> getNearestEntities(vec3f center, std::size_t k, u32 componentMask = 0);
+
+	private:
+		PointGrid<ID> _grid;
+
+		bool hasComponents(ID entityID, u32 componentMask);
+};
+
+// for the scripts: getEntitiesInRadius(x, y, z, r, componentMask = 0) and getNearestEntities(x, y, z, k, componentMask = 0)
+void registerSpatialQueryAPI(lua_State* L, SpatialIndex& index);
+
+// attribute key -> the entities which have it (and by the value for the float attributes)
+// kept up to date by the AttributeStore events - a single added or set attribute is reindexed alone,
+// after the other changes the entity is compared with what is indexed for it
+// (observe the world directly to see the changes within a tick)
+class AttributeIndex: public System
+{
+	public:
+		AttributeIndex(World& world);
+		virtual void onMsg(const EntityEvent& m);
+		// ascending IDs
+		const std::set<ID>& getEntities(const std::string& key) const;
+		const std::set<ID>& getEntities(const std::string& key, float value) const;
+
+	private:
+		struct Value {
+			bool isFloat;
+			float value;
+			// NaN equals NaN - an unchanged NaN attribute is not reindexed
+			bool operator==(const Value& o) const {
+				return isFloat == o.isFloat && (!isFloat || value == o.value || (std::isnan(value) && std::isnan(o.value)));
+			}
+			// NaN is indexed in Entry::all only (no value query finds it)
+			bool isIndexedByValue() const { return isFloat && !std::isnan(value); }
+		};
+		struct Entry {
+			std::set<ID> all;
+			std::unordered_map<float, std::set<ID>> byValue;
+		};
+		using Attributes = std::map<std::string, Value>;
+
+		std::unordered_map<std::string, Entry> _entries;
+		std::vector<Attributes> _indexed; // by entity ID
+		const std::set<ID> _none;
+
+		void add(ID entityID, const std::string& key, const Value& v);
+		void remove(ID entityID, const std::string& key, const Value& v);
+		void update(ID entityID, const std::string& key, AttributeStoreComponent& asc);
+};
+
 class SpellSystem: public System
 {
 	public:
-		SpellSystem(World& world);
+		// the scripts get the spatial queries if there is an index
+		SpellSystem(World& world, SpatialIndex* index = nullptr);
 		~SpellSystem();
 		virtual void update(float timeDelta);
 		virtual void onMsg(const EntityEvent& m);
 		void reload();
 		void addWizard(ID entID);
 		void removeWizard(ID entID);
-		void cast(std::string& incantation, ID author);
-		void collisionCallback(ID objID, ID otherObjID);
+		// the incantation is parsed once (by the spell system script), cast refers to it by the returned ID
+		// defining the same incantation again returns the same ID
+		// returns NO_INCANTATION for a too long or malformed incantation or when the game has too many of them (they are kept for the whole game)
+		// the incantations of the gamemode are not limited (limited = false) - the clients can not fill the table for it
+		u32 defineIncantation(const std::string& incantation, bool limited = true);
+		// NO_INCANTATION if the incantation is not defined
+		u32 findIncantation(const std::string& incantation) const;
+		static const u32 NO_INCANTATION = ~u32(0);
+		void cast(u32 incantation, ID author);
+		// elevation in degrees (-90 - 90)
+		void launch(float elevation, ID author);
+		// passes the contacts of the states the script subscribed to (CONTACT_STATES) in one call
+		void contactCallback(const std::vector<Contact>& contacts);
+		// the failed calls of the script functions since the last call
+		u32 takeScriptFailureC();
 
 	private:
 		lua_State* _luaState;
+		SpatialIndex* _spatialIndex;
+		u8 _contactStateMask; // bit per ContactState
+		std::unordered_map<std::string, u32> _incantationIDs; // kept over reload
+		// resolved by init, released by deinit
+		LuaFunction _lAddWizard;
+		LuaFunction _lRemoveWizard;
+		LuaFunction _lHandleIncantation;
+		LuaFunction _lHandleLaunch;
+		LuaFunction _lDefineIncantation;
+		LuaFunction _lHandleContacts;
+		LuaFunction _lUpdate;
+		LuaFunction _lWizardWalking;
 		void lUpdate(float timeDelta);
 		void lReportWalkingWizard(ID wizID, bool walking);
+		void lDefineIncantation(u32 id, const std::string& incantation);
+		std::vector<LuaFunction*> scriptFunctions();
 
 		void init();
 		void deinit();
@@ -93,11 +332,16 @@ class SpellSystem: public System
 				, float modifierValue, bool permanent, float period);
 };
 
+// for the scripts: the CollisionLayer table and setEntityCollisionFilter(entityID, layer, mask)
+void registerCollisionFilterAPI(lua_State* L, World& world);
+
 class InputSystem: public System
 {
 	public:
 		InputSystem(World& world, SpellSystem& spells);
 		void handleCommand(Command& c, ID controlledObjID);
+		// movement part of handleCommand - used by the client to predict its own character
+		static bool applyMovementCommand(const Command& c, BodyComponent& bc);
 
 	private:
 		BodyComponent* getBodyComponent(ID entID);
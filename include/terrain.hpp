@@ -13,7 +13,7 @@ class Terrain {
 	vec3f normalAt(float x, float y) const;
 	bool contains(float x, float y) const;
 	void setSeed(unsigned seed);
-	unsigned getSeed();
+	unsigned getSeed() const;
 
 	bool dumpHeightmapToImage(std::string fileName);
 
@@ -0,0 +1,214 @@
+#ifndef WIRE_HPP_17_10_14_10_31_26
+#define WIRE_HPP_17_10_14_10_31_26
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <type_traits>
+
+// visitors for the doSerDes(T& t) field lists (t & field; ...)
+// WireSizer computes the encoded size, WireWriter writes into a buffer of that size (no bounds checks),
+// WireReader reads back (bounds checked)
+//
+// the encoding is compact and not portable: trivially copyable fields are memcpy'd in native byte order,
+// strings and containers are prefixed with u32 element count
+
+// types which are copied with a single memcpy (specialize for POD structs)
+template <typename T>
+struct WirePod: std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value>
+{};
+
+class WireSizer {
+	public:
+		static const bool reading = false;
+
+		WireSizer(): _size{0}
+		{}
+
+		template <typename T>
+			typename std::enable_if<WirePod<T>::value>::type operator&(const T&) {
+				_size += sizeof(T);
+			}
+
+		void operator&(const std::string& s) {
+			_size += sizeof(uint32_t) + s.size();
+		}
+
+		template <typename T>
+			void operator&(const std::vector<T>& v) {
+				_size += sizeof(uint32_t);
+				if(WirePod<T>::value)
+					_size += v.size()*sizeof(T);
+				else
+					for(const T& e : v)
+						*this & e;
+			}
+
+		template <typename K, typename V>
+			void operator&(const std::map<K,V>& m) {
+				_size += sizeof(uint32_t);
+				for(const auto& p : m) {
+					*this & p.first;
+					*this & p.second;
+				}
+			}
+
+		std::size_t size() const {
+			return _size;
+		}
+
+	private:
+		std::size_t _size;
+};
+
+////////////////////////////////////////////////////////////
+
+class WireWriter {
+	public:
+		static const bool reading = false;
+
+		// out must have room for the size computed by WireSizer
+		WireWriter(char* out): _begin{out}, _p{out}
+		{}
+
+		template <typename T>
+			typename std::enable_if<WirePod<T>::value>::type operator&(const T& d) {
+				write(&d, sizeof(T));
+			}
+
+		void operator&(const std::string& s) {
+			writeCount(s.size());
+			write(s.data(), s.size());
+		}
+
+		template <typename T>
+			typename std::enable_if<WirePod<T>::value>::type operator&(const std::vector<T>& v) {
+				writeCount(v.size());
+				write(v.data(), v.size()*sizeof(T));
+			}
+
+		template <typename T>
+			typename std::enable_if<!WirePod<T>::value>::type operator&(const std::vector<T>& v) {
+				writeCount(v.size());
+				for(const T& e : v)
+					*this & e;
+			}
+
+		template <typename K, typename V>
+			void operator&(const std::map<K,V>& m) {
+				writeCount(m.size());
+				for(const auto& p : m) {
+					*this & p.first;
+					*this & p.second;
+				}
+			}
+
+		std::size_t written() const {
+			return _p - _begin;
+		}
+
+	private:
+		char* _begin;
+		char* _p;
+
+		void write(const void* d, std::size_t size) {
+			if(size == 0)
+				return;
+			std::memcpy(_p, d, size);
+			_p += size;
+		}
+
+		void writeCount(std::size_t c) {
+			uint32_t c32 = c;
+			write(&c32, sizeof(c32));
+		}
+};
+
+////////////////////////////////////////////////////////////
+
+class WireReader {
+	public:
+		static const bool reading = true;
+
+		WireReader(const char* data, std::size_t size): _p{data}, _end{data+size}, _ok{true}
+		{}
+
+		template <typename T>
+			typename std::enable_if<WirePod<T>::value>::type operator&(T& d) {
+				read(&d, sizeof(T));
+			}
+
+		void operator&(std::string& s) {
+			uint32_t c = readCount(1);
+			s.assign(_p, c);
+			_p += c;
+		}
+
+		template <typename T>
+			typename std::enable_if<WirePod<T>::value>::type operator&(std::vector<T>& v) {
+				uint32_t c = readCount(sizeof(T));
+				v.resize(c);
+				read(v.data(), c*sizeof(T));
+			}
+
+		template <typename T>
+			typename std::enable_if<!WirePod<T>::value>::type operator&(std::vector<T>& v) {
+				uint32_t c = readCount(1);
+				v.clear();
+				for(uint32_t i = 0; i < c && _ok; i++) {
+					v.emplace_back();
+					*this & v.back();
+				}
+			}
+
+		template <typename K, typename V>
+			void operator&(std::map<K,V>& m) {
+				uint32_t c = readCount(1);
+				m.clear();
+				for(uint32_t i = 0; i < c && _ok; i++) {
+					K k;
+					*this & k;
+					*this & m[k];
+				}
+			}
+
+		// false if the data ended too soon
+		bool ok() const {
+			return _ok;
+		}
+
+		// true if all the data was consumed
+		bool atEnd() const {
+			return _p == _end;
+		}
+
+	private:
+		const char* _p;
+		const char* _end;
+		bool _ok;
+
+		void read(void* d, std::size_t size) {
+			if(size == 0)
+				return;
+			if(!_ok || std::size_t(_end-_p) < size) {
+				_ok = false;
+				std::memset(d, 0, size);
+				return;
+			}
+			std::memcpy(d, _p, size);
+			_p += size;
+		}
+
+		// count of elements which are at least minElementSize bytes long (a greater one means corrupted data)
+		uint32_t readCount(std::size_t minElementSize) {
+			uint32_t c;
+			read(&c, sizeof(c));
+			if(std::size_t(_end-_p)/minElementSize < c) {
+				_ok = false;
+				c = 0;
+			}
+			return c;
+		}
+};
+#endif /* WIRE_HPP_17_10_14_10_31_26 */
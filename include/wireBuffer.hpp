@@ -0,0 +1,186 @@
+#ifndef WIREBUFFER_HPP_17_10_15_19_02_44
+#define WIREBUFFER_HPP_17_10_15_19_02_44
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <utility>
+
+class BufferPool;
+
+// immutable reference counted bytes - one encoded packet shared by all the sessions it is sent to
+class WireBuffer
+{
+	friend class BufferPool;
+	struct Block {
+		std::vector<char> bytes;
+		std::atomic<unsigned> refs;
+		BufferPool* pool;
+	};
+
+	public:
+		WireBuffer(): _b{nullptr}
+		{}
+
+		WireBuffer(const WireBuffer& other): _b{other._b}
+		{
+			if(_b)
+				++_b->refs;
+		}
+
+		WireBuffer(WireBuffer&& other) noexcept: _b{other._b}
+		{
+			other._b = nullptr;
+		}
+
+		WireBuffer& operator=(WireBuffer other)
+		{
+			std::swap(_b, other._b);
+			return *this;
+		}
+
+		~WireBuffer()
+		{
+			release();
+		}
+
+		const char* data() const
+		{
+			return _b ? _b->bytes.data() : nullptr;
+		}
+
+		std::size_t size() const
+		{
+			return _b ? _b->bytes.size() : 0;
+		}
+
+		bool empty() const
+		{
+			return size() == 0;
+		}
+
+		unsigned useCount() const
+		{
+			return _b ? _b->refs.load() : 0;
+		}
+
+	private:
+		Block* _b;
+
+		explicit WireBuffer(Block* b): _b{b}
+		{}
+
+		inline void release();
+};
+
+////////////////////////////////////////////////////////////
+
+// recycles the storage of released WireBuffers (the capacity is kept, so steady traffic does not allocate)
+// the pool has to outlive the buffers it gave out
+class BufferPool
+{
+	friend class WireBuffer;
+	using Block = WireBuffer::Block;
+
+	public:
+		BufferPool(std::size_t maxFree = 256): _maxFree{maxFree}, _allocated{0}
+		{}
+
+		BufferPool(const BufferPool&) = delete;
+		BufferPool& operator=(const BufferPool&) = delete;
+
+		~BufferPool()
+		{
+			assert(_free.size() == _allocated);
+			for(Block* b : _free)
+				delete b;
+		}
+
+		WireBuffer copy(const void* data, std::size_t size)
+		{
+			Block* b = acquire();
+			b->bytes.resize(size);
+			if(size)
+				std::memcpy(b->bytes.data(), data, size);
+			return WireBuffer(b);
+		}
+
+		// data prefixed with its size as 4 byte big endian integer (framing of sf::Packet on a TCP socket)
+		WireBuffer frame(const void* data, std::size_t size)
+		{
+			Block* b = acquire();
+			b->bytes.resize(4+size);
+			uint32_t s = size;
+			char* out = b->bytes.data();
+			out[0] = char(s >> 24);
+			out[1] = char(s >> 16);
+			out[2] = char(s >> 8);
+			out[3] = char(s);
+			if(size)
+				std::memcpy(out+4, data, size);
+			return WireBuffer(b);
+		}
+
+		// buffers which are free to reuse
+		std::size_t getFreeCount()
+		{
+			std::lock_guard<std::mutex> l(_mutex);
+			return _free.size();
+		}
+
+		// all the buffers owned by the pool (free + in use)
+		std::size_t getAllocatedCount()
+		{
+			std::lock_guard<std::mutex> l(_mutex);
+			return _allocated;
+		}
+
+	private:
+		std::vector<Block*> _free;
+		std::mutex _mutex;
+		std::size_t _maxFree;
+		std::size_t _allocated;
+
+		Block* acquire()
+		{
+			Block* b = nullptr;
+			{
+				std::lock_guard<std::mutex> l(_mutex);
+				if(!_free.empty()) {
+					b = _free.back();
+					_free.pop_back();
+				}
+				else
+					++_allocated;
+			}
+			if(!b) {
+				b = new Block;
+				b->pool = this;
+			}
+			b->refs = 1;
+			return b;
+		}
+
+		void recycle(Block* b)
+		{
+			{
+				std::lock_guard<std::mutex> l(_mutex);
+				if(_free.size() < _maxFree) {
+					_free.push_back(b);
+					return;
+				}
+				--_allocated;
+			}
+			delete b;
+		}
+};
+
+void WireBuffer::release()
+{
+	if(_b && --_b->refs == 0)
+		_b->pool->recycle(_b);
+	_b = nullptr;
+}
+#endif /* WIREBUFFER_HPP_17_10_15_19_02_44 */
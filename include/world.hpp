@@ -5,7 +5,6 @@
 #include <memory>
 #include "main.hpp"
 #include "controller.hpp"
-#include "serializable.hpp"
 #include "observableEntityComponent.hpp"
 #include "keyValueStore.hpp"
 #include "worldMap.hpp"
@@ -23,6 +22,23 @@ enum ObjStaticID: ID {
 };
 static_assert(OBJCHILD == u64(1<<15));
 
+// collision layers - bits of the layer and the mask of CollisionComponent,
+// two bodies collide only if the layer of each one is in the mask of the other one
+namespace CollisionLayer {
+	enum: u16 {
+		Default   = 1<<0,
+		Terrain   = 1<<1, // the map and the fence around it
+		Character = 1<<2,
+		Spell     = 1<<3,
+		Tree      = 1<<4,
+		All       = 0xFFFF,
+
+		// default masks
+		SpellMask = All & ~Spell,      // spells pass through each other
+		TreeMask  = Character | Spell, // static, only the moving bodies are tested against trees
+	};
+}
+
 enum ComponentType: u8
 {
 	NONE = 0, 
@@ -49,10 +65,11 @@ namespace std
 		};
 }
 
-class ObservableComponentBase : public Observable<EntityEvent>, public Serializable {
+class ObservableComponentBase : public Observable<EntityEvent> {
 	public:
 		ObservableComponentBase(ID parentEntID, ComponentType realCompType);
 		void notifyObservers();
+		ComponentType getComponentType() const;
 	private:
 		EntityEvent _updMsg;
 };
@@ -82,7 +99,6 @@ class BodyComponent: public ObservableComponentBase
 		//vec3f getTotalVelocity() const;
 		vec2f getStrafeDir() const;
 		float getStrafeSpeed() const;
-		virtual void serDes(SerDesBase& s);
 		template <typename T>
 			void doSerDes(T& t)
 			{
@@ -116,7 +132,6 @@ class GraphicsComponent: public ObservableComponentBase
 		void setPosOffset(vec3f);
 		void setRotOffset(vec3f);
 		void setScale(vec3f);
-		virtual void serDes(SerDesBase& s);
 		template <typename T>
 			void doSerDes(T& t)
 			{
@@ -135,10 +150,10 @@ class SphereGraphicsComponent: public GraphicsComponent
 {
 	public:
 		SphereGraphicsComponent(ID parentEntID, float radius = 0, vec3f posOffset = vec3f(0), vec3f rotOffset = vec3f(0), vec3f scale = vec3f(1));
-		virtual void serDes(SerDesBase& s);
 		template <typename T>
 			void doSerDes(T& t)
 			{
+				GraphicsComponent::doSerDes(t);
 				t & _radius;
 			}
 		float getRadius();
@@ -152,10 +167,10 @@ class MeshGraphicsComponent: public GraphicsComponent
 {
 	public:
 		MeshGraphicsComponent(ID parentEntID, string fileName = "", bool animated = false, vec3f posOffset = vec3f(0), vec3f rotOffset = vec3f(0), vec3f scale = vec3f(1));
-		virtual void serDes(SerDesBase& s);
 		template <typename T>
 			void doSerDes(T& t)
 			{
+				GraphicsComponent::doSerDes(t);
 				t & _fileName;
 				t & _animated;
 			}
@@ -171,10 +186,10 @@ class ParticleSystemGraphicsComponent: public GraphicsComponent
 {
 	public:
 		ParticleSystemGraphicsComponent(ID parentEntID, ID effectID = NULLID, vec3f posOffset = vec3f(0), vec3f rotOffset = vec3f(0), vec3f scale = vec3f(1));
-		virtual void serDes(SerDesBase& s);
 		template <typename T>
 			void doSerDes(T& t)
 			{
+				GraphicsComponent::doSerDes(t);
 				t & _effectID;
 			}
 		ID getEffectID();
@@ -188,7 +203,8 @@ class ParticleSystemGraphicsComponent: public GraphicsComponent
 class CollisionComponent: public ObservableComponentBase
 {
 	public:
-		CollisionComponent(ID parentEntID, float radius = 1, float height = 0, vec3f posOffset = vec3f(0,0,0), float mass = 0, bool kinematic = false, float gravity = -10);
+		CollisionComponent(ID parentEntID, float radius = 1, float height = 0, vec3f posOffset = vec3f(0,0,0), float mass = 0, bool kinematic = false, float gravity = -10,
+				u16 layer = CollisionLayer::Default, u16 mask = CollisionLayer::All);
 		float getRadius() const;
 		void setRadius(float);
 		float getHeight() const;
@@ -200,8 +216,10 @@ class CollisionComponent: public ObservableComponentBase
 		float getGravity();
 		void setSlippery(bool slippery);
 		bool isSlippery();
+		u16 getLayer() const;
+		u16 getMask() const;
+		void setFilter(u16 layer, u16 mask);
 
-		virtual void serDes(SerDesBase& s);
 		template <typename T>
 			void doSerDes(T& t)
 			{
@@ -212,6 +230,8 @@ class CollisionComponent: public ObservableComponentBase
 				t & _mass;
 				t & _gravity;
 				t & _slippery;
+				t & _layer;
+				t & _mask;
 			}
 
 	private:
@@ -222,6 +242,8 @@ class CollisionComponent: public ObservableComponentBase
 		bool _kinematic;
 		float _gravity;
 		bool _slippery;
+		u16 _layer;
+		u16 _mask;
 };
 
 ////////////////////////////////////////////////////////////
@@ -230,7 +252,6 @@ class WizardComponent: public ObservableComponentBase
 {
 	public:
 		WizardComponent(ID parentEntID);
-		virtual void serDes(SerDesBase& s);
 		template <typename T>
 			void doSerDes(T& t)
 			{
@@ -311,11 +332,21 @@ class AttributeStoreComponent: public ObservableComponentBase, KeyValueStore
 		void addAttribute(std::string key, float value);
 		void addAttribute(std::string key, std::string value);
 		bool hasAttribute(std::string key);
+		bool isStringAttribute(const std::string& key) const;
 		template <typename T>
 		T getAttribute(std::string key) const
 		{
 			return getValue<T>(key);
 		}
+		// the attribute added or set by the notification being sent, nullptr otherwise
+		// (the affectors and the deserialization may change any of them)
+		const std::string* getChangedAttribute() const;
+		// f(const std::string& key, float value), g(const std::string& key, const std::string& value)
+		template <typename FloatF, typename StringF>
+		void forEachAttribute(FloatF f, StringF g) const
+		{
+			forEachPair(f, g);
+		}
 		void setAttribute(std::string key, float value);
 		void setAttribute(std::string key, std::string value);
 		void setOrAddAttribute(std::string key, float value);
@@ -326,15 +357,18 @@ class AttributeStoreComponent: public ObservableComponentBase, KeyValueStore
 		float getAttributeAffected(std::string key);
 		std::vector<AttributeAffector> getAttributeAffectorHistory();
 
-		virtual void serDes(SerDesBase& s);
 		template <typename T>
 			void doSerDes(T& t)
 			{
+				KeyValueStore::doSerDes(t);
 			}
 
 	private:
 		SolidVector<AttributeAffector, ID, NULLID> _attributeAffectors;
 		RingBuffer<AttributeAffector> _attributeAffectorHistory;
+		const std::string* _changedAttribute;
+
+		void notifyAttributeChanged(const std::string& key);
 };
 
 ////////////////////////////////////////////////////////////
@@ -354,6 +388,9 @@ class World: public Observabler<EntityEvent>
 	private:
 		const WorldMap& _map;
 		EntityManager _entManager;
+
+		template <typename ComponentClass>
+		void registerComponent(ComponentType t);
 };
 
 ////////////////////////////////////////////////////////////
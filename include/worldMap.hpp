@@ -3,13 +3,13 @@
 #include <memory>
 #include "terrain.hpp"
 #include "treePlanter.hpp"
-#include "serializable.hpp"
+#include "pointGrid.hpp"
 
 struct Spawnpoint {
 	vec3f position;
 };
 
-class WorldMap: public Serializable {
+class WorldMap {
 	public:
 		WorldMap(): _terrain(nullptr)
 		{}
@@ -59,26 +59,20 @@ class WorldMap: public Serializable {
 			return _terrain->size();
 		}
 
-		virtual void serDes(SerDesBase& s)
-		{
-			s.serDes(*this);
-		}
-
-		template <typename T>
-			void doSer(T& t)
-			{
-				t & getSize();
-				t & _terrain->getSeed();
-			}
-
+		// the map is generated from its size and seed on both sides
 		template <typename T>
-			void doDes(T& t)
+			void doSerDes(T& t)
 			{
 				vec2u size;
-				unsigned seed;
+				unsigned seed = 0;
+				if(_terrain) {
+					size = getSize();
+					seed = _terrain->getSeed();
+				}
 				t & size;
 				t & seed;
-				generate(size, seed);
+				if(T::reading)
+					generate(size, seed);
 			}
 
 		const std::vector<Spawnpoint>& getSpawnpoints() const
@@ -98,28 +92,30 @@ class WorldMap: public Serializable {
 			float minTreeDistance = 2;
 			unsigned first = edgePadding;
 			unsigned last = int(getSize().X-1-edgePadding)/step*step;
+			PointGrid<u32> trees;
+			for(u32 i = 0; i < _trees.size(); ++i)
+				trees.set(i, _trees[i].position.X, 0, _trees[i].position.Z);
 			for(unsigned y = first; y <= last; y += step)
 				for(unsigned x = first; x <= last; x += step)
 				{
 					if(x != first && x != last && y != first && y != last)
 						continue;
 					else {
-						if(nearestTreeDistance(vec2u(x,y)) >= minTreeDistance)
+						if(nearestTreeDistance(trees, vec2u(x,y)) >= minTreeDistance)
 							_spawns.push_back(Spawnpoint{vec3f(x,getHeightAt(x,y),y)});
 					}
 				}
 		}
 
-		float nearestTreeDistance(vec2u from)
+		// trees - the indices of _trees at their positions (in the ground plane)
+		float nearestTreeDistance(const PointGrid<u32>& trees, vec2u from)
 		{
-			float r = std::numeric_limits<float>::max();
-			for(const Tree& t : _trees)
-			{
-				float d = vec2f(t.position.X, t.position.Z).getDistanceFrom(vec2f(from.X, from.Y));
-				if(d < r)
-					r = d;
-			}
-			return r;
+			std::vector<u32> nearest;
+			trees.nearest(from.X, 0, from.Y, 1, [](u32) { return true; }, nearest);
+			if(nearest.empty())
+				return std::numeric_limits<float>::max();
+			const Tree& t = _trees[nearest[0]];
+			return vec2f(t.position.X, t.position.Z).getDistanceFrom(vec2f(from.X, from.Y));
 		}
 };
 
@@ -10,6 +10,9 @@ void addBodyComponent(entityID, posX, posY, posZ)
 void setGameRegValue(key, value)
 void endRound()
 void commandCharacter(entityID, commandStr)
+void setEntityCollisionFilter(entityID, layer, mask) -- bits of the CollisionLayer table, collide if each layer is in the other one's mask
+[entityID] getEntitiesInRadius(x, y, z, radius, componentMask = 0) -- mask bits 1 << ComponentType.X, the entities must have all of them
+[entityID] getNearestEntities(x, y, z, k, componentMask = 0) -- the closest first
 
 the gm_info_template string can contain | to separate logical parts and <key> to substite the value of the key
 --]]
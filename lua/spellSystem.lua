@@ -53,8 +53,13 @@ Config.Wizard.maxBodiesAlive = 50
 
 
 -------------------- globals --------------------
+-- contacts reported to handleContacts, persist keeps the spells resting in the ground stopped
+CONTACT_STATES = {"begin", "persist"}
+ContactState = {BEGIN = 0, PERSIST = 1, END = 2}
+
 WIZARDS = {}
 SPELLS = {}
+INCANTATIONS = {} -- ID -> incantation parsed by defineIncantation
 
 -------------------- classes ------------------
 
@@ -85,9 +90,9 @@ function Wizard:returnBody()
 end
 
 function Wizard:handleIncantation(inc)
-	dout(LF,"======= Spell system <handleIncantation> called =======",inc)
+	dout(LF,"======= Spell system <handleIncantation> called =======",inc.inc)
 	dout("Wizard ID: "..self.ID)
-	if(string.match(inc, "[^%s]+_now%s*.*") ~= nil) then
+	if inc.now then
 		-- execute the _now commands immediately
 		dout("exec now")
 		self:resetInvocation()
@@ -130,7 +135,11 @@ function Wizard:updateStatus()
 		end
 	end
 	local invocEffId = effectIdFromIncantation(self.invocIncantation)
-	updateWizardStatus(self.ID, self.invocIncantation or "", invocEffId or -1, self.invocT, progress, 
+	local invocInc = ""
+	if self.invocIncantation ~= nil then
+		invocInc = self.invocIncantation.inc
+	end
+	updateWizardStatus(self.ID, invocInc, invocEffId or -1, self.invocT, progress, 
 	p, r, s, effects,
 	Config.Wizard.maxBodiesAlive-self.bodiesInUse, Config.Wizard.maxBodiesAlive,
 	self:getCommandQueueAsEffectIDs())
@@ -151,23 +160,35 @@ function effectIdFromIncantation(inc)
 	if inc == nil then
 		return nil
 	end
-	local c, args = incantationToCommandAndArgs(inc)
-	if string.find(c, "spell_effect") then
-		return Config.Effects[args].effectID
-	elseif string.find(c, "spell_body") then
-		return 0
-	else
-		return nil
-	end
+	return inc.effectID
 end
 
 function incantationToCommandAndArgs(inc)
 	return string.match(inc, "(spell_[^%s]+)%s*(.*)")
 end
 
+-- inc: the incantation string, command and args: its parts, now: execute it immediately,
+-- effectID: what it produces (nil for nothing)
+function parseIncantation(inc)
+	local command, args = incantationToCommandAndArgs(inc)
+	local r = {inc = inc, command = command, args = args or "", now = false}
+	if command == nil then
+		return r
+	end
+	r.now = string.match(command, "_now$") ~= nil
+	if string.find(command, "spell_effect") then
+		if Config.Effects[r.args] ~= nil then
+			r.effectID = Config.Effects[r.args].effectID
+		end
+	elseif string.find(command, "spell_body") then
+		r.effectID = BODYEFFECTID
+	end
+	return r
+end
+
 function Wizard:execIncantation(inc)
-	command, argStr = incantationToCommandAndArgs(inc)
-	if Wizard.Command[command] ~= nil then
+	local command, argStr = inc.command, inc.args
+	if command ~= nil and Wizard.Command[command] ~= nil then
 		self.invocIncantation = inc
 		self.invoc = coroutine.create(
 		function(self, argStr)
@@ -470,11 +491,27 @@ function removeWizard(ID)
 	end
 end
 
-function handleIncantation(wizID, inc)
+function defineIncantation(incID, inc)
+	INCANTATIONS[incID] = parseIncantation(inc)
+end
+
+function handleIncantation(wizID, incID)
 	if WIZARDS[wizID] == nil then
 		dout("handleIncantation: wizard ID "..wizID.." does not exist")
+	elseif INCANTATIONS[incID] == nil then
+		dout("handleIncantation: incantation "..incID.." is not defined")
 	else
-		WIZARDS[wizID]:handleIncantation(inc)
+		WIZARDS[wizID]:handleIncantation(INCANTATIONS[incID])
+	end
+end
+
+-- elevation: angle in degrees (-90 - 90)
+function handleLaunch(wizID, elevation)
+	if WIZARDS[wizID] == nil then
+		dout("handleLaunch: wizard ID "..wizID.." does not exist")
+	else
+		local cmd = "spell_launch_direct_now"
+		WIZARDS[wizID]:handleIncantation({inc = cmd.." "..elevation, command = cmd, args = elevation, now = true})
 	end
 end
 
@@ -493,6 +530,16 @@ function handleCollision(obj1ID, obj2ID)
 	end
 end
 
+-- contacts: {first1, second1, state1, first2, ...} - each touching pair once per tick (see ContactState)
+function handleContacts(contacts)
+	for i = 1, #contacts, 3 do
+		if contacts[i+2] ~= ContactState.END then
+			handleCollision(contacts[i], contacts[i+1])
+			handleCollision(contacts[i+1], contacts[i])
+		end
+	end
+end
+
 function wizardWalking(wizID, walking)
 	if WIZARDS[wizID] ~= nil then
 		WIZARDS[wizID]:setWalking(walking)
@@ -0,0 +1,260 @@
+#include "bot.hpp"
+#include "network.hpp"
+#include <serdes.hpp>
+
+Bot::Bot(unsigned index, const BotConfig& config): _index{index}, _config{config}, _connected{false}, _inGame{false}, _random{index},
+	_moveTimer{0}, _turnTimer{0}, _castTimer{0}, _yAngle{0}, _rejoinTimer{-1}, _nextSeq{1}
+{
+	// do not let all the bots act at the same moment
+	std::uniform_real_distribution<float> d(0, 1);
+	_moveTimer = d(_random)*_config.movePeriod;
+	_turnTimer = d(_random)*_config.turnPeriod;
+	_castTimer = d(_random)*_config.castPeriod;
+}
+
+bool Bot::connect(std::string host, unsigned short port)
+{
+	_connected = _socket.connect(host, port) == sf::Socket::Done;
+	if(!_connected)
+		return false;
+	_socket.setBlocking(false);
+	sendHello();
+	return true;
+}
+
+void Bot::update(float timeDelta)
+{
+	if(!_connected)
+		return;
+	receive();
+	if(_rejoinTimer >= 0 && (_rejoinTimer -= timeDelta) < 0) {
+		sf::Packet p;
+		p << PacketType::JoinGame;
+		sendPacket(p);
+	}
+	if(_inGame)
+		act(timeDelta);
+}
+
+bool Bot::isConnected() const
+{
+	return _connected;
+}
+
+const Bot::Stats& Bot::getStats() const
+{
+	return _stats;
+}
+
+void Bot::report(std::ostream& o, float period)
+{
+	o << "bot #" << _index << (_connected ? "" : " (disconnected)")
+		<< ": rtt avg " << (_stats.rttSamples ? _stats.rttSum/_stats.rttSamples*1000 : 0) << " ms"
+		<< ", max " << _stats.rttMax*1000 << " ms"
+		<< ", updates " << _stats.updatesReceived/period << "/s"
+		<< ", in " << _stats.bytesReceived/period/1024 << " kB/s (" << _stats.packetsReceived/period << " packets/s)"
+		<< ", out " << _stats.bytesSent/period/1024 << " kB/s (" << _stats.packetsSent/period << " packets/s)"
+		<< std::endl;
+	_stats = Stats();
+}
+
+void Bot::receive()
+{
+	sf::Packet p;
+	sf::Socket::Status r;
+	while((r = _socket.receive(p)) == sf::Socket::Status::Done)
+		handlePacket(p);
+	if(r == sf::Socket::Status::Disconnected || r == sf::Socket::Status::Error) {
+		cerr << "bot #" << _index << ": server disconnected.\n";
+		_connected = false;
+	}
+}
+
+void Bot::handlePacket(sf::Packet& p)
+{
+	++_stats.packetsReceived;
+	_stats.bytesReceived += p.getDataSize() + sizeof(u32);
+	PacketType t;
+	p >> t;
+	switch(t)
+	{
+		case PacketType::WorldSnapshot:
+			if(_world)
+				readWorldSnapshot(p, *_world);
+			break;
+		case PacketType::WorldUpdate:
+			++_stats.updatesReceived;
+			if(_world)
+				readWorldUpdate(p, *_world);
+			break;
+		case PacketType::InputAck:
+			{
+				u32 seq;
+				p >> seq;
+				auto acked = _unackedSendTimes.upper_bound(seq);
+				if(acked != _unackedSendTimes.begin()) {
+					float rtt = _clock.getElapsedTime().asSeconds() - std::prev(acked)->second;
+					++_stats.rttSamples;
+					_stats.rttSum += rtt;
+					_stats.rttMax = std::max(_stats.rttMax, rtt);
+				}
+				_unackedSendTimes.erase(_unackedSendTimes.begin(), acked);
+				break;
+			}
+		case PacketType::GameInit:
+			{
+				_world.reset();
+				_map.reset(new WorldMap());
+				p >> Deserializer<sf::Packet>(*_map);
+				_world.reset(new World(*_map));
+				_inGame = true;
+				sf::Packet d;
+				d << PacketType::DefineIncantations << std::vector<std::string>{"spell_body_create 1 1 3 die{map,player}", "spell_effect_create fire"};
+				sendPacket(d);
+				Command c(Command::Type::SET_NAME);
+				c._str = "bot" + std::to_string(_index);
+				sendCommand(c);
+				break;
+			}
+		case PacketType::GameOver:
+			_inGame = false;
+			_world.reset();
+			_map.reset();
+			_rejoinTimer = 1;
+			break;
+		case PacketType::Redirect:
+			{
+				std::string address;
+				u16 port;
+				p >> address >> port;
+				_socket.disconnect();
+				_socket.setBlocking(true);
+				if(!connect(address, port))
+					cerr << "bot #" << _index << ": failed to connect to the game server " << address << ":" << port << ".\n";
+				break;
+			}
+		default:
+			break;
+	}
+}
+
+void Bot::act(float timeDelta)
+{
+	std::uniform_real_distribution<float> d(-1, 1);
+	if((_moveTimer -= timeDelta) < 0) {
+		_moveTimer += _config.movePeriod;
+		Command c(Command::Type::STRAFE_DIR_SET);
+		c._vec2f = vec2f(std::round(d(_random)), std::round(d(_random)));
+		sendCommand(c);
+	}
+	if((_turnTimer -= timeDelta) < 0) {
+		_turnTimer += _config.turnPeriod;
+		_yAngle = std::fmod(_yAngle + d(_random)*0.5f, PI*2);
+		Command c(Command::Type::Y_ANGLE_SET);
+		c._float = _yAngle;
+		sendCommand(c);
+	}
+	if((_castTimer -= timeDelta) < 0) {
+		_castTimer += _config.castPeriod;
+		// the incantations defined at GameInit
+		for(u32 i : {0, 1}) {
+			Command c(Command::Type::CAST);
+			c._u32 = i;
+			sendCommand(c);
+		}
+		Command c(Command::Type::LAUNCH_SPELL);
+		c._float = 0;
+		sendCommand(c);
+	}
+}
+
+void Bot::sendCommand(Command& c)
+{
+	if(c._type == Command::Type::STRAFE_DIR_SET || c._type == Command::Type::Y_ANGLE_SET) {
+		c._seq = _nextSeq++;
+		_unackedSendTimes[c._seq] = _clock.getElapsedTime().asSeconds();
+	}
+	sf::Packet p;
+	p << PacketType::PlayerCommand << c;
+	sendPacket(p);
+}
+
+void Bot::sendPacket(sf::Packet& p)
+{
+	++_stats.packetsSent;
+	_stats.bytesSent += p.getDataSize() + sizeof(u32);
+	sf::Socket::Status r;
+	while((r = _socket.send(p)) == sf::Socket::Status::Partial);
+	if(r == sf::Socket::Status::Disconnected || r == sf::Socket::Status::Error) {
+		cerr << "bot #" << _index << ": failed to send a packet.\n";
+		_connected = false;
+	}
+}
+
+void Bot::sendHello()
+{
+	sf::Packet p;
+	p << PacketType::ClientHello << u16(myGame_VERSION_MAJOR) << u16(myGame_VERSION_MINOR);
+	sendPacket(p);
+}
+
+////////////////////////////////////////////////////////////
+
+BotApplication::BotApplication(unsigned botCount, BotConfig config): _config{config}
+{
+	for(unsigned i = 0; i < botCount; ++i)
+		_bots.emplace_back(new Bot(i, _config));
+}
+
+unsigned BotApplication::connect(std::string host, unsigned short port)
+{
+	std::cout << "Connecting " << _bots.size() << " bots to " << host << ":" << port << std::endl;
+	unsigned connected = 0;
+	for(auto& b : _bots)
+		if(b->connect(host, port))
+			++connected;
+	return connected;
+}
+
+void BotApplication::run()
+{
+	sf::Clock c;
+	float reportTimer = 0;
+	while(true)
+	{
+		float timeDelta = c.restart().asSeconds();
+		unsigned connected = 0;
+		for(auto& b : _bots) {
+			b->update(timeDelta);
+			if(b->isConnected())
+				++connected;
+		}
+		if(connected == 0) {
+			std::cout << "All bots disconnected.\n";
+			return;
+		}
+
+		if((reportTimer += timeDelta) >= _config.reportPeriod) {
+			Bot::Stats total;
+			for(auto& b : _bots) {
+				const Bot::Stats& s = b->getStats();
+				total.updatesReceived += s.updatesReceived;
+				total.bytesReceived += s.bytesReceived;
+				total.bytesSent += s.bytesSent;
+				total.rttSamples += s.rttSamples;
+				total.rttSum += s.rttSum;
+				total.rttMax = std::max(total.rttMax, s.rttMax);
+				b->report(std::cout, reportTimer);
+			}
+			std::cout << "total (" << connected << " connected)"
+				<< ": rtt avg " << (total.rttSamples ? total.rttSum/total.rttSamples*1000 : 0) << " ms"
+				<< ", max " << total.rttMax*1000 << " ms"
+				<< ", updates " << total.updatesReceived/reportTimer << "/s"
+				<< ", in " << total.bytesReceived/reportTimer/1024 << " kB/s"
+				<< ", out " << total.bytesSent/reportTimer/1024 << " kB/s"
+				<< std::endl;
+			reportTimer = 0;
+		}
+		sf::sleep(sf::milliseconds(1));
+	}
+}
@@ -0,0 +1,142 @@
+#include "characterController.hpp"
+
+static const btScalar WALK_SPEED = 5;
+static const btScalar GROUND_ACCELERATION = 40; // full speed in 1/8 s
+static const btScalar AIR_ACCELERATION = 5;
+static const btScalar MAX_SLOPE_COS = 0.64; // 50 degrees
+static const btScalar SKIN = 0.02; // the capsule stops this far from what it hits
+static const btScalar GROUND_SNAP = 0.3; // walking down a slope does not make the character fall
+static const unsigned MAX_SLIDES = 4;
+
+// the closest hit of the sweep which is not the swept object and which the motion goes into
+// (moving out of a surface is never blocked, so a slightly penetrating capsule does not get stuck)
+class ClosestNotMeConvexResultCallback: public btCollisionWorld::ClosestConvexResultCallback
+{
+	public:
+		ClosestNotMeConvexResultCallback(btCollisionObject* me, const btVector3& from, const btVector3& to)
+			: btCollisionWorld::ClosestConvexResultCallback(from, to), _me{me}, _motion{to-from}
+		{
+			m_collisionFilterGroup = me->getBroadphaseHandle()->m_collisionFilterGroup;
+			m_collisionFilterMask = me->getBroadphaseHandle()->m_collisionFilterMask;
+		}
+
+		virtual btScalar addSingleResult(btCollisionWorld::LocalConvexResult& convexResult, bool normalInWorldSpace)
+		{
+			if(convexResult.m_hitCollisionObject == _me)
+				return 1;
+			btVector3 normal = normalInWorldSpace ? convexResult.m_hitNormalLocal :
+				convexResult.m_hitCollisionObject->getWorldTransform().getBasis()*convexResult.m_hitNormalLocal;
+			if(normal.dot(_motion) >= 0)
+				return 1;
+			return btCollisionWorld::ClosestConvexResultCallback::addSingleResult(convexResult, normalInWorldSpace);
+		}
+
+	private:
+		btCollisionObject* _me;
+		btVector3 _motion;
+};
+
+CharacterController::CharacterController(): _velocity{0, 0, 0}, _onGround{false}
+{}
+
+void CharacterController::step(btCollisionWorld& world, btCollisionObject& object, vec3f walkDir, float gravity, float timeDelta)
+{
+	// walking - the horizontal velocity approaches the desired one, slowly in the air
+	btVector3 desired = btVector3(walkDir.X, 0, walkDir.Z)*WALK_SPEED;
+	btVector3 horizontal(_velocity.x(), 0, _velocity.z());
+	btVector3 change = desired - horizontal;
+	btScalar maxChange = (_onGround ? GROUND_ACCELERATION : AIR_ACCELERATION)*timeDelta;
+	if(change.length() > maxChange)
+		change *= maxChange/change.length();
+	horizontal += change;
+	btScalar vertical = _onGround ? 0 : _velocity.y() + gravity*timeDelta;
+	_velocity = btVector3(horizontal.x(), vertical, horizontal.z());
+
+	btTransform tr = object.getWorldTransform();
+	btVector3 position = slide(world, object, tr.getOrigin(), _velocity*timeDelta);
+
+	// stay on the ground unless moving up (or it went away)
+	if(_onGround || _velocity.y() <= 0) {
+		btVector3 normal;
+		btVector3 down(0, -GROUND_SNAP, 0);
+		btScalar free = sweep(world, object, position, position + down, normal);
+		_onGround = free < 1 && normal.y() >= MAX_SLOPE_COS;
+		if(_onGround) {
+			position += down*btMax(btScalar(0), free - SKIN/GROUND_SNAP);
+			_velocity.setY(0);
+		}
+	}
+
+	tr.setOrigin(position);
+	object.setWorldTransform(tr);
+	// the other characters sweep against the new position in this step already
+	world.updateSingleAabb(&object);
+}
+
+vec3f CharacterController::getVelocity() const
+{
+	return btV3f2V3f(_velocity);
+}
+
+bool CharacterController::isOnGround() const
+{
+	return _onGround;
+}
+
+void CharacterController::reset()
+{
+	_velocity = btVector3(0, 0, 0);
+	_onGround = false;
+}
+
+CharacterController::State CharacterController::getState() const
+{
+	return State{btV3f2V3f(_velocity), _onGround};
+}
+
+void CharacterController::setState(const State& s)
+{
+	_velocity = V3f2btV3f(s.velocity);
+	_onGround = s.onGround;
+}
+
+btVector3 CharacterController::slide(btCollisionWorld& world, btCollisionObject& object, btVector3 from, btVector3 motion)
+{
+	for(unsigned i = 0; i < MAX_SLIDES && motion.length2() > SIMD_EPSILON; ++i)
+	{
+		btVector3 normal;
+		btScalar free = sweep(world, object, from, from + motion, normal);
+		if(free >= 1) {
+			from += motion;
+			break;
+		}
+		btScalar length = motion.length();
+		from += motion*(btMax(btScalar(0), free*length - SKIN)/length);
+		if(normal.y() < MAX_SLOPE_COS && _onGround) {
+			// too steep to walk up - a wall
+			normal.setY(0);
+			if(normal.length2() < SIMD_EPSILON)
+				break;
+			normal.normalize();
+		}
+		motion *= 1 - free;
+		motion -= normal*motion.dot(normal);
+		_velocity -= normal*btMin(btScalar(0), _velocity.dot(normal));
+	}
+	return from;
+}
+
+btScalar CharacterController::sweep(btCollisionWorld& world, btCollisionObject& object, const btVector3& from, const btVector3& to, btVector3& normal)
+{
+	assert(object.getCollisionShape()->isConvex());
+	btTransform fromTr = object.getWorldTransform();
+	btTransform toTr = fromTr;
+	fromTr.setOrigin(from);
+	toTr.setOrigin(to);
+	ClosestNotMeConvexResultCallback callback(&object, from, to);
+	world.convexSweepTest(static_cast<btConvexShape*>(object.getCollisionShape()), fromTr, toTr, callback);
+	if(!callback.hasHit())
+		return 1;
+	normal = callback.m_hitNormalWorld;
+	return callback.m_closestHitFraction;
+}
@@ -3,6 +3,9 @@
 #include "network.hpp"
 #include "serdes.hpp"
 
+static const float MIN_PHYSICS_STEP = 0.001;
+static const float MAX_PHYSICS_STEP = 0.1;
+
 Animator::Animator(scene::ISceneManager* smgr, function<Entity*(ID)> entityResolver, function<vec3f(ID)> entityVelocityGetter)
 	: _smgr{smgr}, _entityResolver{entityResolver}, _velGetter{entityVelocityGetter}
 {}
@@ -76,7 +79,8 @@ void Animator::onMsg(const EntityEvent& m)
 ////////////////////////////////////////////////////////////
 
 ClientApplication::ClientApplication(): _device(nullptr, [](IrrlichtDevice* d){ if(d) d->drop(); }), _controller{nullptr},
-	_yAngleSetCommandFilter{0.2, [](float& oldObj, float& newObj)->float&{ if(std::fabs(oldObj-newObj) > 0.01) return newObj; else return oldObj; }}
+	_yAngleSetCommandFilter{0.2, [](float& oldObj, float& newObj)->float&{ if(std::fabs(oldObj-newObj) > 0.01) return newObj; else return oldObj; }},
+	_physicsStep{0}, _interpolationDelay{0.1}, _statsDumpPeriod{0}, _statsDumpTimer{0}
 {
 	irr::SIrrlichtCreationParameters params;
 	params.DriverType=video::E_DRIVER_TYPE::EDT_OPENGL;
@@ -148,6 +152,11 @@ void ClientApplication::run()
 		}
 
 		while(receive());		
+		_networkStats.update(timeDelta);
+		if(_statsDumpPeriod > 0 && (_statsDumpTimer += timeDelta) >= _statsDumpPeriod) {
+			_statsDumpTimer = 0;
+			_networkStats.dump(cout, "client");
+		}
 		//TODO fix frameLen spike after win inactivity (mind the physics)
 		if(true)//if(_device->isWindowActive())
 		{
@@ -166,10 +175,21 @@ void ClientApplication::run()
 				sendCommand(c);
 			}
 
-			if(_physics)
+			if(_physics) {
+				CharacterController::State characterState;
+				bool predicted = _sharedRegistry.hasKey("controlled_object_id") &&
+					_physics->getCharacterState(_sharedRegistry.getValue<ID>("controlled_object_id"), characterState);
 				_physics->update(timeDelta);
-			if(_vs)
+				if(predicted && _physics->getSimulatedTime() > 0)
+					_predictor.addFrame(characterState, _physics->getSimulatedTime());
+			}
+			if(_projectiles && _physics)
+				_projectiles->update(_physics->getSimulatedTime());
+			if(_vs) {
+				if(_serverClock.hasEstimate())
+					_vs->setRenderTime(getRenderTime());
 				_vs->update(timeDelta);
+			}
 			if(_gui)
 				_gui->update(timeDelta);
 
@@ -205,25 +225,49 @@ void ClientApplication::startGame()
 	_vs.reset();
 	_vs.reset(new ViewSystem(_device->getSceneManager(), *_gameWorld));
 	_physics.reset(new Physics(*_gameWorld, _device->getSceneManager()));
+	// the client follows the server's clock - after a stall (window dragged, loading) it catches up instead of slowing down
+	_physics->setMaxSteps(0);
+	// the predicted moves are replayed over the server's states, they have to be simulated the same way
+	if(_physicsStep > 0)
+		_physics->setStepSize(_physicsStep);
+	_projectiles.reset(new ProjectileSystem(*_gameWorld));
 	_animator.setEntityResolver(bind(&World::getEntity, ref(*_gameWorld), placeholders::_1));
 	_animator.setSceneManager(_device->getSceneManager());
 	_animator.setEntityVelocityGetter([this](ID id)->vec3f {	return _physics->getObjVelocity(id); });
 	_gameWorld->addObserver(_animator);
 	_gameWorld->addObserver(*_physics);
+	_gameWorld->addObserver(*_projectiles);
 	_gameWorld->addObserver(*_vs);
+	_predictor.reset();
+	if(_controller.getSettings().hasKey("INTERPOLATION_DELAY")) {
+		try {
+			_interpolationDelay = std::stof(_controller.getSettings().getValue<std::string>("INTERPOLATION_DELAY"));
+		}
+		catch(std::exception&) {
+			cerr << "error in settings: INTERPOLATION_DELAY is not a number\n";
+		}
+	}
 	_gui.reset();
 	_gui.reset(new GUI(_device.get(), *_gameWorld.get(), _sharedRegistry, _gameRegistry));
 	_gameWorld->addObserver(*_gui);
 	createCamera();
 
+	sf::Packet p;
+	p << PacketType::DefineIncantations << _controller.getIncantations();
+	sendPacket(p);
+
 	if(_controller.getSettings().hasKey("NAME")) {
-		Command c;
-		c._type = Command::Type::STR;
-		c._str = "NAME "+_controller.getSettings().getValue<std::string>("NAME");
+		Command c(Command::Type::SET_NAME);
+		c._str = _controller.getSettings().getValue<std::string>("NAME");
 		sendCommand(c);
 	}
 }
 
+void ClientApplication::setStatsDumpPeriod(float seconds)
+{
+	_statsDumpPeriod = seconds;
+}
+
 void ClientApplication::createCamera()
 {
 	SKeyMap keyMap[9];
@@ -266,10 +310,8 @@ void ClientApplication::commandHandler(Command& c)
 		//nc._float = _cameraYAngle;
 		//sendCommand(nc);
 	}
-	else if(c._type == Command::Type::STR) {
-		size_t kp = c._str.find("$LOOK_ELEVATION");
-		if(kp != std::string::npos)
-			c._str.replace(kp, strlen("$LOOK_ELEVATION"), std::to_string(int(-(_cameraElevation/PI*180)+90)));
+	else if(c._type == Command::Type::LAUNCH_SPELL) {
+		c._float = int(-(_cameraElevation/PI*180)+90);
 		sendCommand(c);
 	}
 	else
@@ -278,6 +320,7 @@ void ClientApplication::commandHandler(Command& c)
 
 void ClientApplication::sendCommand(Command& c)
 {
+	_predictor.predict(c, getControlledBody());
 	sf::Packet p;
 	p << PacketType::PlayerCommand << c;
 	sendPacket(p);
@@ -285,6 +328,7 @@ void ClientApplication::sendCommand(Command& c)
 
 void ClientApplication::sendPacket(sf::Packet& p)
 {
+	_networkStats.packetSent(p.getDataSize() ? PacketType(*static_cast<const u8*>(p.getData())) : PacketTypeCount, p.getDataSize() + sizeof(u32));
 	sf::Socket::Status r;
 	while((r = _server.send(p)) == sf::Socket::Status::Partial);
 	//TODO handle disconnect and errors
@@ -320,18 +364,23 @@ void ClientApplication::handlePacket(sf::Packet& p)
 {
 	PacketType t;
 	p >> t;
+	if(t != PacketType::WorldUpdate)
+		_networkStats.packetReceived(t, p.getDataSize() + sizeof(u32));
 	switch(t)
 	{
 		case PacketType::WorldUpdate:
 			{
 				if(!_gameWorld)
 					return;
+				float serverTime;
 				EntityEvent event(NULLID);	
-				p >> event;
+				p >> serverTime >> event;
+				_networkStats.packetReceived(t, p.getDataSize() + sizeof(u32), event.componentT);
+				_serverClock.addSample(serverTime, _clock.getElapsedTime().asSeconds());
 
 				Entity* entity = nullptr;
 				if(event.created && event.componentT == ComponentType::NONE) {
-					// this may happen: when new client connects, server broadcasts create events for all objects
+					// this may happen: an entity from the join snapshot can be announced again by a queued create event
 					//assert(_gameWorld->getEntity(event.entityID) == nullptr);
 					if((entity = _gameWorld->getEntity(event.entityID)) == nullptr)
 						entity = &_gameWorld->createAndGetEntity(event.entityID);
@@ -348,13 +397,43 @@ void ClientApplication::handlePacket(sf::Packet& p)
 					else if(event.destroyed)
 						entity->removeComponent(event.componentT);
 					if((modifiedComponent = entity->getComponent(event.componentT)) != nullptr) {
+						bool controlled = modifiedComponent == getControlledBody();
 						p >> Deserializer<sf::Packet>(*modifiedComponent);
 						//std::cout << Serializer<std::ostream>(*modifiedComponent) << std::endl;
+						if(controlled && !event.created) {
+							if(_physics)
+								_predictor.reconcile(*static_cast<BodyComponent*>(modifiedComponent), serverTime, *_physics, event.entityID);
+						}
+						else if(!controlled && event.componentT == ComponentType::Body && _vs) {
+							BodyComponent* bc = static_cast<BodyComponent*>(modifiedComponent);
+							CollisionComponent* cc = entity->getComponent<CollisionComponent>();
+							if(cc && cc->isKinematic())
+								// dead reckoned by the local physics, the server sends only the launch state and corrections
+								// -> move the state to the rendered time so it matches the interpolated entities
+								bc->setPosition(bc->getPosition() + bc->getVelocity()*(getRenderTime() - serverTime));
+							else
+								_vs->addNetworkSample(event.entityID, serverTime, *bc);
+						}
 						modifiedComponent->notifyObservers();
 					}
 				}
 				break;
 			}
+		case PacketType::WorldSnapshot:
+			{
+				if(!_gameWorld)
+					return;
+				readWorldSnapshot(p, *_gameWorld);
+				break;
+			}
+		case PacketType::InputAck:
+			{
+				u32 seq;
+				float serverTime;
+				p >> seq >> serverTime;
+				_predictor.acknowledge(seq, serverTime);
+				break;
+			}
 		case PacketType::RegistryUpdate:
 			{
 					p >> Deserializer<sf::Packet>(_sharedRegistry);
@@ -371,6 +450,13 @@ void ClientApplication::handlePacket(sf::Packet& p)
 			{
 				_worldMap.reset(new WorldMap());
 				p >> Deserializer<sf::Packet>(*_worldMap);
+				float step = 0;
+				// the client runs as many steps as the time needs (no limit), a too fine step would stall it
+				if(!(p >> step) || !(step >= MIN_PHYSICS_STEP && step <= MAX_PHYSICS_STEP)) {
+					cerr << "The server's physics step (" << step << " s) is not usable, using the default.\n";
+					step = 0;
+				}
+				_physicsStep = step;
 				startGame();
 				break;
 			}
@@ -381,6 +467,18 @@ void ClientApplication::handlePacket(sf::Packet& p)
 				displayMessage(message);
 				break;
 			}
+		case PacketType::Redirect:
+			{
+				// the router picked a game server for us
+				std::string address;
+				u16 port;
+				p >> address >> port;
+				_server.disconnect();
+				_server.setBlocking(true);
+				if(!connect(address, port))
+					cerr << "Failed to connect to the game server " << address << ":" << port << ".\n";
+				break;
+			}
 			case PacketType::GameOver:
 			{
 				sf::sleep(sf::seconds(1));
@@ -434,3 +532,18 @@ scene::ICameraSceneNode* ClientApplication::getCamera()
 {
 	return static_cast<scene::ICameraSceneNode*>(_device->getSceneManager()->getSceneNodeFromId(ObjStaticID::Camera));
 }
+
+BodyComponent* ClientApplication::getControlledBody()
+{
+	if(!_gameWorld || !_sharedRegistry.hasKey("controlled_object_id"))
+		return nullptr;
+	Entity* e = _gameWorld->getEntity(_sharedRegistry.getValue<ID>("controlled_object_id"));
+	if(e)
+		return e->getComponent<BodyComponent>();
+	return nullptr;
+}
+
+float ClientApplication::getRenderTime()
+{
+	return _serverClock.toRemote(_clock.getElapsedTime().asSeconds()) - _interpolationDelay;
+}
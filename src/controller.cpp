@@ -2,9 +2,21 @@
 #include "controller.hpp"
 #include "gui.hpp"
 
-Command::Command(Type type): _type{type}
+Command::Command(Type type): _type{type}, _seq{0}
 {}
 
+Command::Command(const Command& other): _type{other._type}, _seq{other._seq}, _vec3f{other._vec3f}, _str{other._str}
+{}
+
+Command& Command::operator=(const Command& other)
+{
+	_type = other._type;
+	_seq = other._seq;
+	_vec3f = other._vec3f; // the largest member of the union
+	_str = other._str;
+	return *this;
+}
+
 ////////////////////////////////////////////////////////////
 
 Controller::Controller(IrrlichtDevice* device): _device{device}, _commandHandler{[](Command&){}}, _lastSentMovD{0,0}, _freeCamera{false}
@@ -29,9 +41,9 @@ void Controller::loadSpellBook(std::string fileName) {
 	{
 		std::string spell = lua_valueAsStr(L, -2);
 		Table t = lua_loadTable(L, -1);
-		std::vector<std::string> steps;
+		std::vector<u32> steps;
 		for(auto& s: t)
-			steps.push_back(s.second);
+			steps.push_back(internIncantation(s.second));
 		_spellBook[spell] = steps;
 		lua_pop(L, 1);
 	}
@@ -52,6 +64,8 @@ void Controller::loadControls(std::string fileName) {
 		try {
 			unsigned long keyCode = std::stoul(r.first, &end);
 			_keyMap[static_cast<irr::EKEY_CODE>(keyCode)] = r.second;
+			if(r.second.find("spell_") == 0)
+				internIncantation(r.second);
 		}
 		catch(invalid_argument&) {
 			std::cerr << "error in control settings: \"" << r.first << " = " << r.second << "\"\n";
@@ -132,24 +146,25 @@ bool Controller::OnEvent(const SEvent& event)
 		}
 	}
 	else if(c == "LAUNCH_SPELL_DIRECT" && pressedDown) {
-		Command command(Command::Type::STR);
-		command._str = "spell_launch_direct_now $LOOK_ELEVATION";
+		// the elevation is filled in by the command handler (it knows the camera)
+		Command command(Command::Type::LAUNCH_SPELL);
+		command._float = 0;
 		_commandHandler(command);
 	}
 	else if(c.find("CAST ") == 0 && pressedDown) {
-		Command command(Command::Type::STR);
+		Command command(Command::Type::CAST);
 		std::string spellName = c.substr(5);
 		auto spell = _spellBook.end();
 		if((spell = _spellBook.find(spellName)) != _spellBook.end()) {
-			for(auto& step : spell->second) {
-				command._str = step;
+			for(u32 step : spell->second) {
+				command._u32 = step;
 				_commandHandler(command);
 			}
 		}
 	}
-	else {
-		Command command(Command::Type::STR);
-		command._str = c;
+	else if(_incantationIndices.count(c) && pressedDown) {
+		Command command(Command::Type::CAST);
+		command._u32 = _incantationIndices[c];
 		_commandHandler(command);
 	}
 
@@ -196,9 +211,8 @@ bool Controller::OnEvent(const SEvent& event)
 						std::string s(t.begin(), t.end());
 
 						if(s.length() > 0) {
-							Command c;
-							c._type = Command::Type::STR;
-							c._str = std::string("SAY "+s);
+							Command c(Command::Type::SAY);
+							c._str = s;
 							_commandHandler(c);
 						}
 
@@ -252,3 +266,17 @@ const KeyValueStore& Controller::getSettings() const
 {
 	return _settings;	
 }
+
+const std::vector<std::string>& Controller::getIncantations() const
+{
+	return _incantations;
+}
+
+u32 Controller::internIncantation(const std::string& incantation)
+{
+	auto i = _incantationIndices.find(incantation);
+	if(i != _incantationIndices.end())
+		return i->second;
+	_incantations.push_back(incantation);
+	return _incantationIndices[incantation] = _incantations.size()-1;
+}
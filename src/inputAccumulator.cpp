@@ -0,0 +1,59 @@
+#include "inputAccumulator.hpp"
+
+InputAccumulator::InputAccumulator(std::size_t maxOneShots): _maxOneShots{maxOneShots}, _lastOneShot{0}, _oneShotC{0}, _mergedC{0}, _droppedC{0}
+{}
+
+bool InputAccumulator::add(const Command& c)
+{
+	if(isState(c._type)) {
+		for(std::size_t i = _lastOneShot; i < _commands.size(); ++i)
+			if(_commands[i]._type == c._type) {
+				_commands[i] = c;
+				++_mergedC;
+				return true;
+			}
+		_commands.push_back(c);
+		return true;
+	}
+	if(_oneShotC >= _maxOneShots) {
+		++_droppedC;
+		return false;
+	}
+	_commands.push_back(c);
+	_lastOneShot = _commands.size();
+	++_oneShotC;
+	return true;
+}
+
+void InputAccumulator::flush(std::function<void(Command& c)> apply)
+{
+	for(Command& c : _commands)
+		apply(c);
+	clear();
+}
+
+void InputAccumulator::clear()
+{
+	_commands.clear();
+	_lastOneShot = 0;
+	_oneShotC = 0;
+}
+
+u32 InputAccumulator::takeMergedC()
+{
+	u32 c = _mergedC;
+	_mergedC = 0;
+	return c;
+}
+
+u32 InputAccumulator::takeDroppedC()
+{
+	u32 c = _droppedC;
+	_droppedC = 0;
+	return c;
+}
+
+bool InputAccumulator::isState(Command::Type t)
+{
+	return t == Command::Type::STRAFE_DIR_SET || t == Command::Type::ROT_DIR_SET || t == Command::Type::Y_ANGLE_SET;
+}
@@ -0,0 +1,95 @@
+#include "inputPredictor.hpp"
+#include "system.hpp"
+
+// if the server stops acknowledging (or the packets are lost), do not grow forever
+static const std::size_t MAX_PENDING_COMMANDS = 256;
+static const std::size_t MAX_FRAMES = 512; // at least 5 s of the default 10 ms steps
+
+InputPredictor::InputPredictor(): _nextSeq{1}, _lastAckedSeq{0}, _lastAckTime{0}
+{}
+
+bool InputPredictor::predict(Command& c, BodyComponent* bc)
+{
+	if(c._type != Command::Type::STRAFE_DIR_SET && c._type != Command::Type::Y_ANGLE_SET)
+		return false;
+	c._seq = _nextSeq++;
+	if(_pending.size() >= MAX_PENDING_COMMANDS)
+		_pending.pop_front();
+	PendingInput i;
+	i.seq = c._seq;
+	i.type = c._type;
+	if(c._type == Command::Type::STRAFE_DIR_SET)
+		i.strafeDir = c._vec2f;
+	else
+		i.yAngle = c._float;
+	_pending.push_back(i);
+	if(bc)
+		InputSystem::applyMovementCommand(c, *bc);
+	return true;
+}
+
+void InputPredictor::acknowledge(u32 seq, float serverTime)
+{
+	if(seq < _lastAckedSeq)
+		return;
+	_lastAckedSeq = seq;
+	_lastAckTime = serverTime;
+	while(!_pending.empty() && _pending.front().seq <= seq)
+		_pending.pop_front();
+	// the frames of the acknowledged command are needed until the server simulates past them
+	while(!_frames.empty() && _frames.front().seq < seq)
+		_frames.pop_front();
+}
+
+void InputPredictor::addFrame(const CharacterController::State& state, float simulatedTime)
+{
+	if(_frames.size() >= MAX_FRAMES)
+		_frames.pop_front();
+	_frames.push_back(Frame{_nextSeq-1, simulatedTime, state});
+}
+
+void InputPredictor::reconcile(BodyComponent& bc, float serverTime, Physics& physics, ID character)
+{
+	// the server has moved the character with the acknowledged command for this long,
+	// the client's frames of it are skipped up to that time
+	float simulatedByServer = serverTime - _lastAckTime;
+	std::size_t first = 0;
+	while(first < _frames.size() && _frames[first].seq <= _lastAckedSeq && simulatedByServer >= _frames[first].time/2) {
+		simulatedByServer -= _frames[first].time;
+		++first;
+	}
+	auto p = _pending.begin();
+	if(first < _frames.size()) {
+		physics.resetCharacter(character, _frames[first].state);
+		for(std::size_t i = first; i < _frames.size(); ++i) {
+			for(; p != _pending.end() && p->seq <= _frames[i].seq; ++p)
+				apply(*p, bc);
+			physics.stepCharacter(character, _frames[i].time);
+		}
+	}
+	// predicted after the last frame
+	for(; p != _pending.end(); ++p)
+		apply(*p, bc);
+}
+
+void InputPredictor::apply(const PendingInput& i, BodyComponent& bc)
+{
+	Command c(i.type);
+	if(i.type == Command::Type::STRAFE_DIR_SET)
+		c._vec2f = i.strafeDir;
+	else
+		c._float = i.yAngle;
+	InputSystem::applyMovementCommand(c, bc);
+}
+
+void InputPredictor::reset()
+{
+	_pending.clear();
+	_frames.clear();
+	_lastAckedSeq = _nextSeq-1;
+}
+
+std::size_t InputPredictor::getPendingCount() const
+{
+	return _pending.size();
+}
@@ -20,6 +20,11 @@ bool KeyValueStore::hasKey(std::string key) const
 	return _store.find(key) != _store.end() || _strStore.find(key) != _strStore.end();
 }
 
+bool KeyValueStore::isString(const std::string& key) const
+{
+	return _strStore.find(key) != _strStore.end();
+}
+
 template <>
 std::string KeyValueStore::getValue<std::string>(std::string key) const
 {
@@ -45,8 +50,3 @@ void KeyValueStore::setValue(std::string key, std::string value)
 {
 	_strStore[key] = value;
 }
-
-void KeyValueStore::serDes(SerDesBase& s)
-{
-	s.serDes(*this);
-}
@@ -0,0 +1,52 @@
+#include "luaFunction.hpp"
+
+LuaFunction::LuaFunction(const char* name): _name{name}, _L{nullptr}, _ref{LUA_NOREF}, _failureC{0}, _reported{false}
+{}
+
+bool LuaFunction::resolve(lua_State* L)
+{
+	release();
+	lua_getglobal(L, _name.c_str());
+	if(!lua_isfunction(L, -1)) {
+		lua_pop(L, 1);
+		cerr << "lua function " << _name << " is not defined\n";
+		return false;
+	}
+	_L = L;
+	_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	_reported = false;
+	return true;
+}
+
+void LuaFunction::release()
+{
+	if(_L != nullptr)
+		luaL_unref(_L, LUA_REGISTRYINDEX, _ref);
+	_L = nullptr;
+	_ref = LUA_NOREF;
+}
+
+bool LuaFunction::isResolved() const
+{
+	return _L != nullptr;
+}
+
+u32 LuaFunction::takeFailureC()
+{
+	u32 c = _failureC;
+	_failureC = 0;
+	return c;
+}
+
+bool LuaFunction::call(int argc)
+{
+	if(lua_pcall(_L, argc, 0, 0) == 0)
+		return true;
+	++_failureC;
+	if(!_reported) {
+		cerr << "something went wrong with " << _name << ": " << lua_tostring(_L, -1) << " (further errors are only counted)\n";
+		_reported = true;
+	}
+	lua_pop(_L, 1);
+	return false;
+}
@@ -4,6 +4,9 @@
 #include "world.hpp"
 #include "server.hpp"
 #include "client.hpp"
+#include "bot.hpp"
+#include "router.hpp"
+#include "relay.hpp"
 
 ImageDumper SAVEIMAGE(nullptr);
 
@@ -21,6 +24,22 @@ bool hasCmdOption(const int argc, char* argv[], const std::string& option, std::
 	return false;
 }
 
+// -physics-hz N -> the step in seconds, 0 if N is not a positive number
+float physicsStepFromHz(const std::string& hz)
+{
+	float f = 0;
+	try {
+		f = std::stof(hz);
+	}
+	catch(std::exception&) {
+	}
+	if(!(f > 0) || !std::isfinite(f)) {
+		cerr << "-physics-hz must be a positive number.\n";
+		return 0;
+	}
+	return 1/f;
+}
+
 int main(int argc, char* argv[]) {
 #ifdef DEBUG_BUILD
 	std::cout << "DEBUG BUILD!\n";
@@ -31,22 +50,120 @@ int main(int argc, char* argv[]) {
 	};
 	std::string port = "55555";
 	getCmdOption("-p", &port);
+	std::string controlPort = "55556";
+	getCmdOption("-control", &controlPort);
 	if(getCmdOption("-s")) {
 		irr::SIrrlichtCreationParameters params;
 		params.DriverType = video::E_DRIVER_TYPE::EDT_NULL;
 		IrrlichtDevice* device = createDeviceEx(params);
 		SAVEIMAGE = ImageDumper(device->getVideoDriver());
-		ServerApplication s(device);
+		std::string roomCount = "1";
+		getCmdOption("-rooms", &roomCount);
+		ServerApplication s(device, std::stoul(roomCount));
+		std::string updatePeriod;
+		if(getCmdOption("-u", &updatePeriod) && !updatePeriod.empty())
+			s.setUpdatePeriod(std::stof(updatePeriod)/1000);
+		std::string statsPeriod;
+		if(getCmdOption("-stats", &statsPeriod) && !statsPeriod.empty())
+			s.setStatsDumpPeriod(std::stof(statsPeriod));
+		std::string physicsHz;
+		if(getCmdOption("-physics-hz", &physicsHz) && !physicsHz.empty()) {
+			float step = physicsStepFromHz(physicsHz);
+			if(step == 0)
+				return 1;
+			s.setPhysicsStep(step);
+		}
+		std::string maxSteps;
+		if(getCmdOption("-physics-max-steps", &maxSteps) && !maxSteps.empty())
+			s.setPhysicsMaxSteps(std::stoul(maxSteps));
+		std::string spectatorKey;
+		if(getCmdOption("-spectator-key", &spectatorKey))
+			s.setSpectatorKey(spectatorKey);
+		std::string recordFile;
+		if(getCmdOption("-record", &recordFile) && !recordFile.empty() && !s.record(recordFile)) {
+			cerr << "Cannot record the match to " << recordFile << ".\n";
+			return 1;
+		}
 		if(!s.listen(std::stoi(port))) {
 			cerr << "Cannot listen on port " << port << ".\n";
 			return 1;
 		}
 		std::cout << "listening on " << port << std::endl;
+		std::string router;
+		if(getCmdOption("-register", &router) && !router.empty()) {
+			std::string advertisedAddress;
+			getCmdOption("-advertise", &advertisedAddress);
+			if(!s.registerAtRouter(router, std::stoul(controlPort), advertisedAddress, std::stoul(port)))
+				cerr << "Cannot register at the router " << router << ":" << controlPort << ".\n";
+		}
 		s.run();
 		device->drop();
 	}
+	else if(getCmdOption("-router")) {
+		RouterApplication r;
+		if(!r.listen(std::stoul(port), std::stoul(controlPort))) {
+			cerr << "Cannot listen on ports " << port << " and " << controlPort << ".\n";
+			return 1;
+		}
+		std::cout << "routing clients from " << port << ", backends register on " << controlPort << std::endl;
+		r.run();
+	}
+	else if(getCmdOption("-relay")) {
+		std::string host = "localhost";
+		getCmdOption("-relay", &host);
+		std::string listenPort = "55557";
+		getCmdOption("-spectators", &listenPort);
+		std::string delay = "0", key, room = "0";
+		getCmdOption("-delay", &delay);
+		getCmdOption("-spectator-key", &key);
+		getCmdOption("-room", &room);
+		RelayApplication r(std::stof(delay));
+		std::string statsPeriod;
+		if(getCmdOption("-stats", &statsPeriod) && !statsPeriod.empty())
+			r.setStatsDumpPeriod(std::stof(statsPeriod));
+		if(!r.listen(std::stoul(listenPort))) {
+			cerr << "Cannot listen on port " << listenPort << ".\n";
+			return 1;
+		}
+		if(!r.connect(host, std::stoul(port), key, std::stoul(room)))
+			return 1;
+		std::cout << "relaying to spectators on " << listenPort << std::endl;
+		r.run();
+	}
+	else if(getCmdOption("-replay")) {
+		std::string replayFile;
+		getCmdOption("-replay", &replayFile);
+		irr::SIrrlichtCreationParameters params;
+		params.DriverType = video::E_DRIVER_TYPE::EDT_NULL;
+		IrrlichtDevice* device = createDeviceEx(params);
+		SAVEIMAGE = ImageDumper(device->getVideoDriver());
+		MatchReplay r;
+		if(!r.open(replayFile)) {
+			cerr << "Cannot open the match recording " << replayFile << ".\n";
+			return 1;
+		}
+		std::string physicsHz;
+		if(getCmdOption("-physics-hz", &physicsHz) && !physicsHz.empty()) {
+			float step = physicsStepFromHz(physicsHz);
+			if(step == 0)
+				return 1;
+			r.setPhysicsStep(step);
+		}
+		std::string maxSteps;
+		if(getCmdOption("-physics-max-steps", &maxSteps) && !maxSteps.empty())
+			r.setPhysicsMaxSteps(std::stoul(maxSteps));
+		bool ok = r.run();
+		device->drop();
+		if(!ok) {
+			cerr << "The match recording is malformed.\n";
+			return 1;
+		}
+	}
 	else if(getCmdOption("-c")) {
 		ClientApplication c;
+		std::string statsPeriod;
+		if(getCmdOption("-stats", &statsPeriod) && !statsPeriod.empty())
+			c.setStatsDumpPeriod(std::stof(statsPeriod));
 		std::string addr = "localhost";
 		getCmdOption("-a", &addr);
 		if(!c.connect(addr, std::stoul(port))) {
@@ -56,12 +173,53 @@ int main(int argc, char* argv[]) {
 		std::cout << "connected\n";
 		c.run();
 	}
+	else if(getCmdOption("-b")) {
+		std::string botCount = "1";
+		getCmdOption("-b", &botCount);
+		std::string addr = "localhost";
+		getCmdOption("-a", &addr);
+		BotConfig config;
+		std::string period;
+		if(getCmdOption("-bot-move", &period) && !period.empty())
+			config.movePeriod = std::stof(period);
+		if(getCmdOption("-bot-turn", &period) && !period.empty())
+			config.turnPeriod = std::stof(period);
+		if(getCmdOption("-bot-cast", &period) && !period.empty())
+			config.castPeriod = std::stof(period);
+		if(getCmdOption("-bot-report", &period) && !period.empty())
+			config.reportPeriod = std::stof(period);
+		BotApplication b(std::stoul(botCount), config);
+		if(b.connect(addr, std::stoul(port)) == 0) {
+			cerr << "Failed to connect to the server.\n";
+			return 1;
+		}
+		b.run();
+	}
 	else {
 		std::cout << "options:\n"
 			<< "\t -c\tclient mode\n"
 			<< "\t -s\tserver mode\n"
 			<< "\t -p\tport\n"
-			<< "\t -a\taddress\n";
+			<< "\t -a\taddress\n"
+			<< "\t -u\tworld update period in ms (server)\n"
+			<< "\t -rooms N\tnumber of concurrent games, each runs on its own thread (server)\n"
+			<< "\t -stats S\tprint network statistics every S seconds\n"
+			<< "\t -router\trouter mode - redirects the clients to the least loaded registered server\n"
+			<< "\t -control\tport for the servers registering at the router (router, server)\n"
+			<< "\t -register HOST\toffer the server to the clients of the router on HOST (server)\n"
+			<< "\t -advertise ADDR\taddress the redirected clients connect to (server, default is the one seen by the router)\n"
+			<< "\t -relay HOST\tspectator relay of the game server on HOST:port\n"
+			<< "\t -spectators PORT\tport of the spectator clients (relay)\n"
+			<< "\t -delay S\tdelay of the relayed game in seconds (relay)\n"
+			<< "\t -room N\tspectated room (relay)\n"
+			<< "\t -spectator-key KEY\trelays with the key may spectate (server, relay)\n"
+			<< "\t -record FILE\trecord the matches for a replay (server)\n"
+			<< "\t -replay FILE\treplay the recorded matches headlessly as fast as possible\n"
+			<< "\t -physics-hz N\tphysics steps per second (server, replay - compare the tick cost of the step sizes, default 100)\n"
+			<< "\t -physics-max-steps N\tphysics steps per tick at most, then the game slows down (server, replay, default 10, 0 = unlimited)\n"
+			<< "\t -b N\tload test with N headless bots\n"
+			<< "\t -bot-move, -bot-turn, -bot-cast\tperiods of the bot commands in seconds\n"
+			<< "\t -bot-report\tperiod of the bot statistics report in seconds\n";
 	}
 	return 0;
 }
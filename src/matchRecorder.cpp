@@ -0,0 +1,262 @@
+#include "matchRecorder.hpp"
+#include <sstream>
+#include <algorithm>
+#include "server.hpp"
+#include "serdes.hpp"
+
+static const std::string MAGIC = "myGameMatch";
+
+bool MatchRecorder::open(std::string fileName)
+{
+	_file.open(fileName, std::ios::binary | std::ios::trunc);
+	if(!_file)
+		return false;
+	_tick = 0;
+	_packet.clear();
+	_packet << MAGIC << u16(myGame_VERSION_MAJOR) << u16(myGame_VERSION_MINOR);
+	write();
+	return true;
+}
+
+void MatchRecorder::map(const WorldMap& m)
+{
+	if(!_file.is_open())
+		return;
+	_packet.clear();
+	//TODO FIXME const_cast
+	_packet << u8(MatchRecord::Map) << Serializer<sf::Packet>(const_cast<WorldMap&>(m));
+	write();
+}
+
+void MatchRecorder::tick(float timeDelta)
+{
+	if(!_file.is_open())
+		return;
+	_packet.clear();
+	_packet << u8(MatchRecord::Tick) << timeDelta;
+	write();
+	++_tick;
+}
+
+void MatchRecorder::playerJoined(ID character)
+{
+	if(!_file.is_open())
+		return;
+	_packet.clear();
+	_packet << u8(MatchRecord::PlayerJoined) << character;
+	write();
+}
+
+void MatchRecorder::playerLeft(ID character)
+{
+	if(!_file.is_open())
+		return;
+	_packet.clear();
+	_packet << u8(MatchRecord::PlayerLeft) << character;
+	write();
+}
+
+void MatchRecorder::command(const Command& c, ID entity)
+{
+	if(!_file.is_open())
+		return;
+	_packet.clear();
+	_packet << u8(MatchRecord::PlayerCommand) << _tick << entity << c;
+	write();
+}
+
+void MatchRecorder::incantation(const std::string& incantation)
+{
+	if(!_file.is_open())
+		return;
+	_packet.clear();
+	_packet << u8(MatchRecord::Incantation) << incantation;
+	write();
+}
+
+void MatchRecorder::write()
+{
+	u32 size = _packet.getDataSize();
+	sf::Packet header;
+	header << size;
+	_file.write(static_cast<const char*>(header.getData()), header.getDataSize());
+	_file.write(static_cast<const char*>(_packet.getData()), size);
+	if(!_file) {
+		cerr << "Failed to write the match recording, recording stopped.\n";
+		_file.close();
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+MatchReplay::MatchReplay(): _gameC{0}, _physicsStep{0}, _physicsMaxSteps{-1}
+{}
+
+MatchReplay::~MatchReplay()
+{}
+
+bool MatchReplay::open(std::string fileName)
+{
+	_file.open(fileName, std::ios::binary);
+	if(!_file)
+		return false;
+	sf::Packet p;
+	std::string magic;
+	u16 vMajor, vMinor;
+	if(!read(p) || !(p >> magic >> vMajor >> vMinor) || magic != MAGIC) {
+		cerr << fileName << " is not a match recording.\n";
+		return false;
+	}
+	if(vMajor != u16(myGame_VERSION_MAJOR) || vMinor != u16(myGame_VERSION_MINOR))
+		cerr << "The match was recorded by version " << vMajor << "." << vMinor << ", the replay may diverge.\n";
+	return true;
+}
+
+bool MatchReplay::run()
+{
+	sf::Packet p;
+	sf::Clock c;
+	while(read(p)) {
+		u8 type;
+		p >> type;
+		switch(MatchRecord(type))
+		{
+			case MatchRecord::Map:
+			{
+				endGame();
+				p >> Deserializer<sf::Packet>(_map);
+				startGame();
+				break;
+			}
+			case MatchRecord::Tick:
+			{
+				float timeDelta;
+				if(!(p >> timeDelta) || !_game)
+					return false;
+				sf::Clock tickClock;
+				_game->run(timeDelta);
+				float tickTime = tickClock.getElapsedTime().asSeconds();
+				++_gameStats.ticks;
+				_gameStats.simulatedTime += timeDelta;
+				_gameStats.tickTime += tickTime;
+				_gameStats.maxTickTime = std::max(_gameStats.maxTickTime, tickTime);
+				break;
+			}
+			case MatchRecord::PlayerJoined:
+			{
+				ID recorded;
+				if(!(p >> recorded) || !_game)
+					return false;
+				ID character = _game->addCharacter();
+				if(character != recorded)
+					cerr << "Replay diverged: character " << character << " created instead of " << recorded << ".\n";
+				break;
+			}
+			case MatchRecord::PlayerLeft:
+			{
+				ID character;
+				if(!(p >> character) || !_game)
+					return false;
+				_game->removeCharacter(character);
+				break;
+			}
+			case MatchRecord::PlayerCommand:
+			{
+				u32 tick;
+				ID entity;
+				Command command;
+				if(!(p >> tick >> entity >> command) || !_game)
+					return false;
+				if(tick != _gameStats.ticks + _totalStats.ticks)
+					cerr << "Replay diverged: command recorded in tick " << tick << " replayed in tick " << _gameStats.ticks + _totalStats.ticks << ".\n";
+				_game->handlePlayerCommand(command, entity);
+				++_gameStats.commands;
+				break;
+			}
+			case MatchRecord::Incantation:
+			{
+				std::string incantation;
+				if(!(p >> incantation) || !_game)
+					return false;
+				_game->defineIncantation(incantation);
+				break;
+			}
+			default:
+				cerr << "Unknown match record type " << int(type) << ".\n";
+				return false;
+		}
+	}
+	endGame();
+	report(cout, "total", _totalStats);
+	cout << "replayed " << _gameC << " games in " << c.getElapsedTime().asSeconds() << " s\n";
+	return _file.eof();
+}
+
+void MatchReplay::setPhysicsStep(float seconds)
+{
+	_physicsStep = seconds;
+}
+
+void MatchReplay::setPhysicsMaxSteps(unsigned steps)
+{
+	_physicsMaxSteps = steps;
+}
+
+bool MatchReplay::read(sf::Packet& p)
+{
+	p.clear();
+	char header[sizeof(u32)];
+	if(!_file.read(header, sizeof(header)))
+		return false;
+	sf::Packet h;
+	h.append(header, sizeof(header));
+	u32 size;
+	h >> size;
+	std::vector<char> data;
+	data.resize(size);
+	if(size && !_file.read(data.data(), size)) {
+		cerr << "The match recording is truncated.\n";
+		return false;
+	}
+	p.append(data.data(), size);
+	return true;
+}
+
+void MatchReplay::startGame()
+{
+	_game.reset(new Game(_map));
+	if(_physicsStep > 0)
+		_game->setPhysicsStep(_physicsStep);
+	if(_physicsMaxSteps >= 0)
+		_game->setPhysicsMaxSteps(_physicsMaxSteps);
+	++_gameC;
+}
+
+void MatchReplay::endGame()
+{
+	if(!_game)
+		return;
+	Physics::Stats ps = _game->takePhysicsStats();
+	_gameStats.physicsTime = ps.time;
+	_gameStats.droppedTime = ps.droppedTime;
+	std::stringstream name;
+	name << "game " << _gameC;
+	report(cout, name.str(), _gameStats);
+	_totalStats.ticks += _gameStats.ticks;
+	_totalStats.commands += _gameStats.commands;
+	_totalStats.simulatedTime += _gameStats.simulatedTime;
+	_totalStats.tickTime += _gameStats.tickTime;
+	_totalStats.maxTickTime = std::max(_totalStats.maxTickTime, _gameStats.maxTickTime);
+	_totalStats.physicsTime += _gameStats.physicsTime;
+	_totalStats.droppedTime += _gameStats.droppedTime;
+	_gameStats = Stats();
+	_game.reset();
+}
+
+void MatchReplay::report(std::ostream& o, std::string name, const Stats& s)
+{
+	o << name << ": " << s.ticks << " ticks, " << s.commands << " commands, "
+		<< s.simulatedTime << " s simulated in " << s.tickTime << " s, tick avg "
+		<< (s.ticks ? s.tickTime/s.ticks*1000 : 0) << " ms, max " << s.maxTickTime*1000 << " ms, physics "
+		<< s.physicsTime << " s (" << s.droppedTime << " s dropped)\n";
+}
@@ -1,4 +1,5 @@
 #include <network.hpp>
+#include <serdes.hpp>
 
 sf::Packet& operator <<(sf::Packet& packet, const quaternion& q)
 {
@@ -37,7 +38,7 @@ sf::Packet& operator >>(sf::Packet& packet, EntityEvent& m) {
 }
 
 sf::Packet& operator <<(sf::Packet& packet, const Command& m) {
-	packet << m._type;
+	packet << m._type << m._seq;
 	switch(m._type)
 	{
 		case Command::Type::Null:
@@ -48,7 +49,14 @@ sf::Packet& operator <<(sf::Packet& packet, const Command& m) {
 		case Command::Type::ROT_DIR_SET:
 			packet << m._i32;
 			break;
-		case Command::Type::STR:
+		case Command::Type::CAST:
+			packet << m._u32;
+			break;
+		case Command::Type::LAUNCH_SPELL:
+			packet << m._float;
+			break;
+		case Command::Type::SAY:
+		case Command::Type::SET_NAME:
 			packet << m._str;
 			break;
 		case Command::Type::ROT_diff:
@@ -63,7 +71,7 @@ sf::Packet& operator <<(sf::Packet& packet, const Command& m) {
   return packet;
 }
 sf::Packet& operator>>(sf::Packet& packet, Command& m) {
-	packet >> m._type;
+	packet >> m._type >> m._seq;
 	switch(m._type)
 	{
 		case Command::Type::Null:
@@ -74,7 +82,14 @@ sf::Packet& operator>>(sf::Packet& packet, Command& m) {
 		case Command::Type::ROT_DIR_SET:
 			packet >> m._i32;
 			break;
-		case Command::Type::STR:
+		case Command::Type::CAST:
+			packet >> m._u32;
+			break;
+		case Command::Type::LAUNCH_SPELL:
+			packet >> m._float;
+			break;
+		case Command::Type::SAY:
+		case Command::Type::SET_NAME:
 			packet >> m._str;
 			break;
 		case Command::Type::ROT_diff:
@@ -112,3 +127,199 @@ sf::Packet& operator >>(sf::Packet& packet, irr::scene::ESCENE_NODE_TYPE& m)
 	m = (irr::scene::ESCENE_NODE_TYPE)d;
 	return packet;
 }
+
+std::string toString(PacketType t)
+{
+	switch(t)
+	{
+		case PacketType::PlayerCommand: return "PlayerCommand";
+		case PacketType::WorldUpdate: return "WorldUpdate";
+		case PacketType::RegistryUpdate: return "RegistryUpdate";
+		case PacketType::GameRegistryUpdate: return "GameRegistryUpdate";
+		case PacketType::JoinGame: return "JoinGame";
+		case PacketType::GameInit: return "GameInit";
+		case PacketType::GameOver: return "GameOver";
+		case PacketType::ClientHello: return "ClientHello";
+		case PacketType::Message: return "Message";
+		case PacketType::WorldSnapshot: return "WorldSnapshot";
+		case PacketType::InputAck: return "InputAck";
+		case PacketType::Spectate: return "Spectate";
+		case PacketType::Redirect: return "Redirect";
+		case PacketType::BackendRegister: return "BackendRegister";
+		case PacketType::BackendLoad: return "BackendLoad";
+		case PacketType::DefineIncantations: return "DefineIncantations";
+		default: return "PacketType " + std::to_string(int(t));
+	}
+}
+
+std::string toString(ComponentType t)
+{
+	switch(t)
+	{
+		case ComponentType::NONE: return "Entity";
+		case ComponentType::Body: return "Body";
+		case ComponentType::GraphicsSphere: return "GraphicsSphere";
+		case ComponentType::GraphicsMesh: return "GraphicsMesh";
+		case ComponentType::GraphicsParticleSystem: return "GraphicsParticleSystem";
+		case ComponentType::Collision: return "Collision";
+		case ComponentType::Wizard: return "Wizard";
+		case ComponentType::AttributeStore: return "AttributeStore";
+		default: return "ComponentType " + std::to_string(int(t));
+	}
+}
+
+// framed WorldUpdate: u32 size, u8 PacketType, float time, u16 entity ID, u8 ComponentType, ...
+static const std::size_t FRAME_HEADER_SIZE = sizeof(u32);
+static const std::size_t WORLD_UPDATE_COMPONENT_TYPE_OFFSET = FRAME_HEADER_SIZE + sizeof(u8) + sizeof(float) + sizeof(ID);
+
+PacketType peekPacketType(const WireBuffer& b)
+{
+	if(b.size() <= FRAME_HEADER_SIZE)
+		return PacketTypeCount;
+	return PacketType(u8(b.data()[FRAME_HEADER_SIZE]));
+}
+
+ComponentType peekUpdatedComponentType(const WireBuffer& b)
+{
+	if(peekPacketType(b) != PacketType::WorldUpdate || b.size() <= WORLD_UPDATE_COMPONENT_TYPE_OFFSET)
+		return ComponentType::NONE;
+	return ComponentType(u8(b.data()[WORLD_UPDATE_COMPONENT_TYPE_OFFSET]));
+}
+
+BufferPool& getSharedBufferPool()
+{
+	static BufferPool pool;
+	return pool;
+}
+
+WireBuffer framePacket(sf::Packet& packet)
+{
+	return getSharedBufferPool().frame(packet.getData(), packet.getDataSize());
+}
+
+void unframePacket(const WireBuffer& b, sf::Packet& packet)
+{
+	packet.clear();
+	if(b.size() > FRAME_HEADER_SIZE)
+		packet.append(b.data()+FRAME_HEADER_SIZE, b.size()-FRAME_HEADER_SIZE);
+}
+
+SendQueue::SendQueue(std::size_t maxBytes): _offset{0}, _queuedBytes{0}, _maxBytes{maxBytes}
+{}
+
+bool SendQueue::push(const WireBuffer& b)
+{
+	if(_queuedBytes + b.size() > _maxBytes)
+		return false;
+	_queue.push_back(b);
+	_queuedBytes += b.size();
+	return true;
+}
+
+bool SendQueue::flush(sf::TcpSocket& s)
+{
+	while(!_queue.empty()) {
+		const WireBuffer& b = _queue.front();
+		std::size_t sent = 0;
+		sf::Socket::Status r = s.send(b.data()+_offset, b.size()-_offset, sent);
+		_offset += sent;
+		if(r == sf::Socket::Status::Done) {
+			_queuedBytes -= b.size();
+			_queue.pop_front();
+			_offset = 0;
+		}
+		else if(r == sf::Socket::Status::Partial || r == sf::Socket::Status::NotReady)
+			return true; // the socket buffer is full, continue next time
+		else if(r == sf::Socket::Status::Disconnected)
+			return false;
+		else if(r == sf::Socket::Status::Error)
+		{
+			cerr << "An error occured while sending packet.\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+std::size_t SendQueue::size() const
+{
+	return _queue.size();
+}
+
+void SendQueue::swap(SendQueue& other)
+{
+	using std::swap;
+	swap(_queue, other._queue);
+	swap(_offset, other._offset);
+	swap(_queuedBytes, other._queuedBytes);
+	swap(_maxBytes, other._maxBytes);
+}
+
+u32 writeWorldSnapshot(sf::Packet& packet, World& world)
+{
+	auto entities = world.getEntities();
+	u32 entityC = std::distance(entities.begin(), entities.end());
+	packet << entityC;
+	for(Entity& e : entities) {
+		u8 componentC = 0;
+		for(u8 t = ComponentType::NONE+1; t < ComponentType::LAST; ++t)
+			if(e.hasComponent(ComponentType(t)))
+				++componentC;
+		packet << e.getID() << componentC;
+		for(u8 t = ComponentType::NONE+1; t < ComponentType::LAST; ++t) {
+			ObservableComponentBase* c = e.getComponent(ComponentType(t));
+			if(c)
+				packet << ComponentType(t) << Serializer<sf::Packet>(*c);
+		}
+	}
+	return entityC;
+}
+
+void readWorldSnapshot(sf::Packet& packet, World& world)
+{
+	u32 entityC;
+	packet >> entityC;
+	for(u32 i = 0; i < entityC; ++i) {
+		ID entityID;
+		u8 componentC;
+		packet >> entityID >> componentC;
+		Entity* entity = world.getEntity(entityID);
+		if(!entity)
+			entity = &world.createAndGetEntity(entityID);
+		for(u8 j = 0; j < componentC; ++j) {
+			ComponentType t;
+			packet >> t;
+			entity->addComponent(t);
+			ObservableComponentBase* c = entity->getComponent(t);
+			assert(c != nullptr);
+			packet >> Deserializer<sf::Packet>(*c);
+			c->notifyObservers();
+		}
+	}
+}
+
+EntityEvent readWorldUpdate(sf::Packet& packet, World& world)
+{
+	float serverTime;
+	EntityEvent event(NULLID);
+	packet >> serverTime >> event;
+	Entity* entity = nullptr;
+	if(event.created && event.componentT == ComponentType::NONE) {
+		if(!world.getEntity(event.entityID))
+			world.createAndGetEntity(event.entityID);
+	}
+	else if(event.destroyed && event.componentT == ComponentType::NONE)
+		world.removeEntity(event.entityID);
+	else if((entity = world.getEntity(event.entityID)) != nullptr) {
+		if(event.created)
+			entity->addComponent(event.componentT);
+		else if(event.destroyed)
+			entity->removeComponent(event.componentT);
+		ObservableComponentBase* c = entity->getComponent(event.componentT);
+		if(c && !event.destroyed) {
+			packet >> Deserializer<sf::Packet>(*c);
+			c->notifyObservers();
+		}
+	}
+	return event;
+}
@@ -0,0 +1,140 @@
+#include "networkStats.hpp"
+#include <sstream>
+#include <iomanip>
+
+NetworkStats::NetworkStats(): _current{0}, _finishedC{0}, _bucketTime{0}
+{}
+
+void NetworkStats::packetSent(PacketType t, std::size_t bytes, ComponentType updated)
+{
+	Bucket& b = _buckets[_current];
+	if(t < PacketTypeCount) {
+		++b.sent[t].packets;
+		b.sent[t].bytes += bytes;
+	}
+	if(updated != ComponentType::NONE && updated < ComponentType::LAST) {
+		++b.componentsSent[updated].packets;
+		b.componentsSent[updated].bytes += bytes;
+	}
+}
+
+void NetworkStats::packetReceived(PacketType t, std::size_t bytes, ComponentType updated)
+{
+	Bucket& b = _buckets[_current];
+	if(t < PacketTypeCount) {
+		++b.received[t].packets;
+		b.received[t].bytes += bytes;
+	}
+	if(updated != ComponentType::NONE && updated < ComponentType::LAST) {
+		++b.componentsReceived[updated].packets;
+		b.componentsReceived[updated].bytes += bytes;
+	}
+}
+
+void NetworkStats::sendQueueDepth(std::size_t buffers)
+{
+	Bucket& b = _buckets[_current];
+	b.maxSendQueueDepth = std::max(b.maxSendQueueDepth, buffers);
+}
+
+void NetworkStats::encodeTime(float seconds)
+{
+	Bucket& b = _buckets[_current];
+	b.encodeTime += seconds;
+	++b.encodeC;
+}
+
+void NetworkStats::update(float timeDelta)
+{
+	_bucketTime += timeDelta;
+	while(_bucketTime >= 1) {
+		_bucketTime -= 1;
+		_current = (_current+1)%_buckets.size();
+		_buckets[_current] = Bucket();
+		_finishedC = std::min(_finishedC+1, WINDOW);
+	}
+}
+
+NetworkStats::Counter NetworkStats::getSent(unsigned seconds) const
+{
+	Counter total;
+	sum(seconds, [](const Bucket& b) {
+			Counter all;
+			for(const Counter& c : b.sent) {
+				all.packets += c.packets;
+				all.bytes += c.bytes;
+			}
+			return all;
+		}, total);
+	return total;
+}
+
+NetworkStats::Counter NetworkStats::getReceived(unsigned seconds) const
+{
+	Counter total;
+	sum(seconds, [](const Bucket& b) {
+			Counter all;
+			for(const Counter& c : b.received) {
+				all.packets += c.packets;
+				all.bytes += c.bytes;
+			}
+			return all;
+		}, total);
+	return total;
+}
+
+unsigned NetworkStats::sum(unsigned seconds, CounterGetter get, Counter& total) const
+{
+	unsigned n = std::min(seconds, _finishedC);
+	for(unsigned i = 1; i <= n; ++i) {
+		Counter c = get(_buckets[(_current+_buckets.size()-i)%_buckets.size()]);
+		total.packets += c.packets;
+		total.bytes += c.bytes;
+	}
+	return n;
+}
+
+void NetworkStats::dumpCounter(std::ostream& o, std::string what, CounterGetter get) const
+{
+	Counter last, window;
+	unsigned lastN = sum(1, get, last);
+	unsigned windowN = sum(WINDOW, get, window);
+	if(window.packets == 0)
+		return;
+	o << "\t" << std::setw(24) << std::left << what << std::right
+		<< " 1s: " << std::setw(8) << (lastN ? last.bytes/1024./lastN : 0) << " kB/s " << std::setw(6) << (lastN ? last.packets/float(lastN) : 0) << " packets/s"
+		<< " | " << windowN << "s: " << std::setw(8) << window.bytes/1024./windowN << " kB/s " << std::setw(6) << window.packets/float(windowN) << " packets/s\n";
+}
+
+void NetworkStats::dump(std::ostream& out, std::string name) const
+{
+	// formatted aside - the caller's stream (cout shared by the rooms) keeps its flags, and it gets one write
+	std::ostringstream o;
+	Counter sent = getSent(WINDOW);
+	Counter received = getReceived(WINDOW);
+	std::size_t maxQueueDepth = 0;
+	float encodeTime = 0;
+	u32 encodeC = 0;
+	for(unsigned i = 1; i <= _finishedC; ++i) {
+		const Bucket& b = _buckets[(_current+_buckets.size()-i)%_buckets.size()];
+		maxQueueDepth = std::max(maxQueueDepth, b.maxSendQueueDepth);
+		encodeTime += b.encodeTime;
+		encodeC += b.encodeC;
+	}
+	float window = std::max(1u, _finishedC);
+	o << std::fixed << std::setprecision(2)
+		<< name << ": out " << sent.bytes/1024./window << " kB/s, in " << received.bytes/1024./window << " kB/s"
+		<< ", max send queue " << maxQueueDepth;
+	if(encodeC)
+		o << ", encode " << encodeTime/encodeC*1000 << " ms/tick";
+	o << "\n";
+	for(unsigned t = 0; t < PacketTypeCount; ++t)
+		dumpCounter(o, "out " + toString(PacketType(t)), [t](const Bucket& b){ return b.sent[t]; });
+	for(unsigned t = 0; t < ComponentType::LAST; ++t)
+		dumpCounter(o, "out update " + toString(ComponentType(t)), [t](const Bucket& b){ return b.componentsSent[t]; });
+	for(unsigned t = 0; t < PacketTypeCount; ++t)
+		dumpCounter(o, "in " + toString(PacketType(t)), [t](const Bucket& b){ return b.received[t]; });
+	for(unsigned t = 0; t < ComponentType::LAST; ++t)
+		dumpCounter(o, "in update " + toString(ComponentType(t)), [t](const Bucket& b){ return b.componentsReceived[t]; });
+	out << o.str();
+}
@@ -0,0 +1,227 @@
+#include "relay.hpp"
+#include <serdes.hpp>
+
+RelayApplication::RelayApplication(float delay): _port{0}, _room{0}, _connected{false}, _reconnectTimer{0},
+	_delay{delay}, _time{0}, _statsDumpPeriod{0}, _statsDumpTimer{0}
+{
+	_listener.setBlocking(false);
+}
+
+bool RelayApplication::connect(std::string host, unsigned short port, std::string key, u16 room)
+{
+	_host = host;
+	_port = port;
+	_key = key;
+	_room = room;
+	return subscribe();
+}
+
+bool RelayApplication::listen(unsigned short port)
+{
+	return _listener.listen(port) == sf::Socket::Done;
+}
+
+void RelayApplication::setStatsDumpPeriod(float seconds)
+{
+	_statsDumpPeriod = seconds;
+}
+
+void RelayApplication::run()
+{
+	sf::Clock c;
+	while(true)
+	{
+		float timeDelta = c.restart().asSeconds();
+		_time += timeDelta;
+
+		unique_ptr<sf::TcpSocket> sock(new sf::TcpSocket);
+		if(_listener.accept(*sock) == sf::Socket::Done) {
+			cout << "Spectator connected from " << sock->getRemoteAddress() << endl;
+			sock->setBlocking(false);
+			Spectator s;
+			s.socket = std::move(sock);
+			_spectators.push_back(std::move(s));
+		}
+
+		if(_connected)
+			receiveUpstream();
+		else if((_reconnectTimer -= timeDelta) < 0) {
+			_reconnectTimer = 5;
+			subscribe();
+		}
+		release();
+
+		for(auto s = _spectators.begin(); s != _spectators.end();) {
+			handleSpectator(*s);
+			if(s->closed) {
+				cout << "Spectator disconnected.\n";
+				s = _spectators.erase(s);
+			}
+			else
+				++s;
+		}
+
+		_networkStats.update(timeDelta);
+		if(_statsDumpPeriod > 0 && (_statsDumpTimer += timeDelta) >= _statsDumpPeriod) {
+			_statsDumpTimer = 0;
+			_networkStats.dump(cout, "relay (" + std::to_string(_spectators.size()) + " spectators)");
+		}
+
+		sf::sleep(sf::milliseconds(10));
+	}
+}
+
+bool RelayApplication::subscribe()
+{
+	_upstream.setBlocking(true);
+	if(_upstream.connect(_host, _port) != sf::Socket::Done) {
+		cerr << "Cannot connect to the game server " << _host << ":" << _port << ".\n";
+		return false;
+	}
+	sf::Packet p;
+	p << PacketType::Spectate << u16(myGame_VERSION_MAJOR) << u16(myGame_VERSION_MINOR) << _key << _room;
+	_connected = _upstream.send(p) == sf::Socket::Done;
+	_upstream.setBlocking(false);
+	if(_connected)
+		cout << "Spectating room " << _room << " of " << _host << ":" << _port << endl;
+	return _connected;
+}
+
+void RelayApplication::receiveUpstream()
+{
+	sf::Packet p;
+	sf::Socket::Status r;
+	while((r = _upstream.receive(p)) == sf::Socket::Status::Done) {
+		if(p.getDataSize() == 0)
+			continue;
+		PacketType t = PacketType(*static_cast<const u8*>(p.getData()));
+		WireBuffer b = framePacket(p);
+		_networkStats.packetReceived(t, b.size(), peekUpdatedComponentType(b));
+		switch(t)
+		{
+			case PacketType::GameInit:
+			case PacketType::WorldSnapshot:
+			case PacketType::WorldUpdate:
+			case PacketType::GameRegistryUpdate:
+			case PacketType::GameOver:
+				_delayed.push_back(Delayed{_time + _delay, std::move(b)});
+				break;
+			case PacketType::Message:
+			{
+				std::string message;
+				p >> t >> message;
+				// the game server talks to the relay only when it refuses it
+				cerr << "Game server: " << message << endl;
+				break;
+			}
+			default:
+				break; // the relay's own registry, acks, ...
+		}
+	}
+	if(r == sf::Socket::Status::Disconnected || r == sf::Socket::Status::Error) {
+		cerr << "Lost the connection to the game server.\n";
+		_connected = false;
+		_reconnectTimer = 5;
+	}
+}
+
+void RelayApplication::release()
+{
+	sf::Packet p;
+	while(!_delayed.empty() && _delayed.front().releaseTime <= _time) {
+		WireBuffer b = std::move(_delayed.front().buffer);
+		_delayed.pop_front();
+		unframePacket(b, p);
+		PacketType t;
+		p >> t;
+		switch(t)
+		{
+			case PacketType::GameInit:
+				_world.reset();
+				_map.reset(new WorldMap());
+				p >> Deserializer<sf::Packet>(*_map);
+				_world.reset(new World(*_map));
+				_gameInit = b;
+				_gameRegistry = WireBuffer();
+				break;
+			case PacketType::WorldSnapshot:
+				if(_world)
+					readWorldSnapshot(p, *_world);
+				break;
+			case PacketType::WorldUpdate:
+				if(_world)
+					readWorldUpdate(p, *_world);
+				break;
+			case PacketType::GameRegistryUpdate:
+				_gameRegistry = b;
+				break;
+			case PacketType::GameOver:
+				_world.reset();
+				_map.reset();
+				_gameInit = WireBuffer();
+				_gameRegistry = WireBuffer();
+				break;
+			default:
+				break;
+		}
+		broadcast(b);
+	}
+}
+
+void RelayApplication::handleSpectator(Spectator& s)
+{
+	sf::Packet p;
+	sf::Socket::Status r;
+	while(!s.closed && (r = s.socket->receive(p)) == sf::Socket::Status::Done) {
+		PacketType t;
+		p >> t;
+		if(t != PacketType::ClientHello || s.watching)
+			continue; // spectators do not play
+		u16 vMajor, vMinor;
+		p >> vMajor >> vMinor;
+		if(vMajor != u16(myGame_VERSION_MAJOR) || vMinor != u16(myGame_VERSION_MINOR)) {
+			sf::Packet m;
+			m << PacketType::Message << std::string("Version mismatch.");
+			send(s, framePacket(m));
+			s.closed = true;
+		}
+		else
+			startWatching(s);
+	}
+	if(r == sf::Socket::Status::Disconnected || r == sf::Socket::Status::Error)
+		s.closed = true;
+	if(!s.sendQueue.flush(*s.socket))
+		s.closed = true;
+}
+
+void RelayApplication::startWatching(Spectator& s)
+{
+	s.watching = true;
+	if(_gameInit.empty())
+		return; // the next game starts with GameInit for everyone
+	send(s, _gameInit);
+	sf::Packet p;
+	p << PacketType::WorldSnapshot;
+	writeWorldSnapshot(p, *_world);
+	send(s, framePacket(p));
+	if(!_gameRegistry.empty())
+		send(s, _gameRegistry);
+}
+
+void RelayApplication::send(Spectator& s, const WireBuffer& b)
+{
+	if(s.closed)
+		return;
+	if(!s.sendQueue.push(b)) {
+		cerr << "Send queue of a spectator is full, disconnecting it.\n";
+		s.closed = true;
+	}
+}
+
+void RelayApplication::broadcast(const WireBuffer& b)
+{
+	_networkStats.packetSent(peekPacketType(b), b.size(), peekUpdatedComponentType(b));
+	for(Spectator& s : _spectators)
+		if(s.watching)
+			send(s, b);
+}
@@ -0,0 +1,129 @@
+#include "router.hpp"
+#include <algorithm>
+
+RouterApplication::RouterApplication(): _helloTimeout{5}
+{
+	_clientListener.setBlocking(false);
+	_controlListener.setBlocking(false);
+}
+
+bool RouterApplication::listen(unsigned short clientPort, unsigned short controlPort)
+{
+	return _clientListener.listen(clientPort) == sf::Socket::Done && _controlListener.listen(controlPort) == sf::Socket::Done;
+}
+
+void RouterApplication::run()
+{
+	sf::Clock c;
+	while(true)
+	{
+		accept();
+		float timeDelta = c.restart().asSeconds();
+		for(auto b = _backends.begin(); b != _backends.end();)
+			if(handleBackend(*b))
+				++b;
+			else {
+				cout << "Backend disconnected: " << b->address << ":" << b->port << endl;
+				b = _backends.erase(b);
+			}
+		for(auto cl = _clients.begin(); cl != _clients.end();)
+			if(handleClient(*cl, timeDelta))
+				++cl;
+			else
+				cl = _clients.erase(cl);
+		sf::sleep(sf::milliseconds(10));
+	}
+}
+
+void RouterApplication::accept()
+{
+	unique_ptr<sf::TcpSocket> sock(new sf::TcpSocket);
+	if(_clientListener.accept(*sock) == sf::Socket::Done) {
+		sock->setBlocking(false);
+		_clients.push_back(Client{std::move(sock)});
+		sock.reset(new sf::TcpSocket);
+	}
+	if(_controlListener.accept(*sock) == sf::Socket::Done) {
+		sock->setBlocking(false);
+		Backend b;
+		b.socket = std::move(sock);
+		_backends.push_back(std::move(b));
+	}
+}
+
+bool RouterApplication::handleClient(Client& c, float timeDelta)
+{
+	sf::Packet p;
+	sf::Socket::Status r = c.socket->receive(p);
+	if(r == sf::Socket::Status::Disconnected || r == sf::Socket::Status::Error)
+		return false;
+	if(r != sf::Socket::Status::Done)
+		return (c.waitTime += timeDelta) < _helloTimeout;
+
+	PacketType t;
+	u16 vMajor, vMinor;
+	p >> t >> vMajor >> vMinor;
+	sf::Packet reply;
+	if(t != PacketType::ClientHello)
+		reply << PacketType::Message << std::string("Unauthorized.");
+	else if(vMajor != u16(myGame_VERSION_MAJOR) || vMinor != u16(myGame_VERSION_MINOR))
+		reply << PacketType::Message << std::string("Version mismatch.");
+	else if(Backend* b = chooseBackend()) {
+		reply << PacketType::Redirect << b->address << b->port;
+		// counted until the backend reports its load again, so a burst of clients is spread
+		++b->players;
+		cout << "Redirecting " << c.socket->getRemoteAddress() << " to " << b->address << ":" << b->port << endl;
+	}
+	else
+		reply << PacketType::Message << std::string("No game server is available.");
+	sendAndDisconnect(*c.socket, reply);
+	return false;
+}
+
+bool RouterApplication::handleBackend(Backend& b)
+{
+	sf::Packet p;
+	sf::Socket::Status r;
+	while((r = b.socket->receive(p)) == sf::Socket::Status::Done) {
+		PacketType t;
+		p >> t;
+		switch(t)
+		{
+			case PacketType::BackendRegister:
+			{
+				p >> b.address >> b.port;
+				if(b.address.empty())
+					b.address = b.socket->getRemoteAddress().toString();
+				b.registered = true;
+				cout << "Backend registered: " << b.address << ":" << b.port << endl;
+				break;
+			}
+			case PacketType::BackendLoad:
+				p >> b.players >> b.tickTime;
+				break;
+			default:
+				cerr << "Received unknown packet type from a backend.\n";
+		}
+	}
+	return r != sf::Socket::Status::Disconnected && r != sf::Socket::Status::Error;
+}
+
+RouterApplication::Backend* RouterApplication::chooseBackend()
+{
+	Backend* best = nullptr;
+	for(Backend& b : _backends) {
+		if(!b.registered)
+			continue;
+		if(!best || b.players < best->players || (b.players == best->players && b.tickTime < best->tickTime))
+			best = &b;
+	}
+	return best;
+}
+
+void RouterApplication::sendAndDisconnect(sf::TcpSocket& s, sf::Packet& p)
+{
+	// the reply is tiny and the last thing sent, no need for a send queue
+	s.setBlocking(true);
+	s.send(p);
+	s.disconnect();
+}
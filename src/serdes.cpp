@@ -0,0 +1,9 @@
+#include <serdes.hpp>
+#include <array>
+
+ComponentCodec& getComponentCodec(ComponentType t)
+{
+	static std::array<ComponentCodec, ComponentType::LAST> codecs{};
+	assert(t < ComponentType::LAST);
+	return codecs[t];
+}
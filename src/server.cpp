@@ -1,9 +1,14 @@
 #include <server.hpp>
 #include <cassert>
+#include <sstream>
 #include <serdes.hpp>
 
-Session::Session(unique_ptr<sf::TcpSocket>&& socket, GameJoinRequestHandler h, Broadcaster b)
-	: _game{nullptr}, _requestGameJoin{h}, _broadcast{b}, _socket{std::move(socket)}, _closed{false}, _authorized{false}
+static const u32 MAX_MEMBER_INCANTATIONS = 256; // the rest of the client's list is ignored
+// how many incantations one member may add to the game's table (kept for the whole game) - the others still get their share
+static const u32 MEMBER_INCANTATION_SHARE = 64;
+
+Session::Session(unique_ptr<sf::TcpSocket>&& socket, u32 connection, GameJoinRequestHandler h)
+	: _room{nullptr}, _connection{connection}, _requestGameJoin{h}, _socket{std::move(socket)}, _closed{false}, _authorized{false}, _spectator{false}, _spectatedRoom{0}
 {
 	_sharedRegistry.addObserver(*this);
 	addPair("controlled_object_id", NULLID);
@@ -11,8 +16,8 @@ Session::Session(unique_ptr<sf::TcpSocket>&& socket, GameJoinRequestHandler h, B
 
 Session::~Session()
 {
-	if(_game)
-		leaveGame();
+	if(_room)
+		leaveRoom();
 }
 
 Session::Session(Session&& other): Session()
@@ -28,12 +33,17 @@ Session& Session::operator=(Session&& other)
 void Session::swap(Session& other)
 {
 	using std::swap;
-	swap(_game, other._game);
+	swap(_room, other._room);
+	swap(_connection, other._connection);
 	swap(_requestGameJoin, other._requestGameJoin);
-	swap(_broadcast, other._broadcast);
 	swap(_socket, other._socket);
 	swap(_closed, other._closed);
 	swap(_authorized, other._authorized);
+	_sendQueue.swap(other._sendQueue);
+	swap(_stats, other._stats);
+	swap(_spectator, other._spectator);
+	swap(_spectatorKey, other._spectatorKey);
+	swap(_spectatedRoom, other._spectatedRoom);
 	swap(_sharedRegistry, other._sharedRegistry);
 	using ObserverT = Observer<KeyValueStoreChange<PacketType>>;
 	swap(static_cast<ObserverT&>(*this), static_cast<ObserverT&>(other));
@@ -44,7 +54,7 @@ void swap(Session& lhs, Session& rhs)
 	lhs.swap(rhs);
 }
 
-Session::Session(): Session(std::unique_ptr<sf::TcpSocket>(nullptr), [](Session&) { return false; }, [](sf::Packet&, ClientFilterPredicate){})
+Session::Session(): Session(std::unique_ptr<sf::TcpSocket>(nullptr), 0, [](Session&) { return false; })
 {}
 
 sf::TcpSocket& Session::getSocket()
@@ -72,27 +82,49 @@ bool Session::receive()
 	 	// this just means that there is no data available
 		return false;
 	}
+	_stats.packetReceived(p.getDataSize() ? PacketType(*static_cast<const u8*>(p.getData())) : PacketTypeCount, p.getDataSize() + sizeof(u32));
 	handlePacket(p);
 	return true;
 }
 
 void Session::send(sf::Packet& p)
+{
+	send(framePacket(p));
+}
+
+void Session::send(const WireBuffer& b)
 {
 	if(!_socket) {
 		cerr << "SEND ON NULL SOCKET\n";
 		return;
 	}
-	sf::Socket::Status r;
-	while((r = _socket->send(p)) == sf::Socket::Status::Partial);
-	if(r == sf::Socket::Status::Disconnected)
-		_closed = true;
-	else if(r == sf::Socket::Status::Error)
-	{
-		cerr << "An error occured while sending packet.\n";
+	if(_closed)
+		return;
+	// the client does not read its data
+	if(!_sendQueue.push(b)) {
+		cerr << "Send queue of " << getRemoteAddress() << " is full, closing the session.\n";
 		_closed = true;
+		return;
 	}
-	else if(r == sf::Socket::Status::NotReady)
-		cerr << "Attept to send data through a socket that was not ready.\n";
+	_stats.packetSent(peekPacketType(b), b.size(), peekUpdatedComponentType(b));
+	flushSendQueue();
+}
+
+void Session::flushSendQueue()
+{
+	if(!_closed && !_sendQueue.flush(*_socket))
+		_closed = true;
+	_stats.sendQueueDepth(_sendQueue.size());
+}
+
+std::size_t Session::getSendQueueSize() const
+{
+	return _sendQueue.size();
+}
+
+NetworkStats& Session::getStats()
+{
+	return _stats;
 }
 
 void Session::send(PacketType t)
@@ -113,26 +145,16 @@ void Session::handlePacket(sf::Packet& p)
 			disconnectUnauthorized();
 			Command c;
 			p >> c;
-			if(c._type == Command::Type::STR && c._str.find("SAY") == 0) {
-				std::string msg = c._str.substr(strlen("SAY "));
-				std::string name;
-				Entity* e;
-				AttributeStoreComponent* as;
-				if(_game &&
-						(e = _game->getWorldEntity(getControlledObjID())) &&
-						 (as = e->getComponent<AttributeStoreComponent>()) &&
-						 (as->hasAttribute("name")))
-						name = as->getAttribute<std::string>("name");
-				if(name.length() > 0)
-					msg = name + ": " + msg;
-				sf::Packet p;
-				p << PacketType::Message << std::string("{all}")+msg;
-				ID author = getControlledObjID();
-				std::cout << "MESSAGE: " << msg << std::endl;
-				_broadcast(p, [author](ID)->bool{ return true; });
+			u32 connection = _connection;
+			if(!_room)
+				break;
+			if(c._type == Command::Type::SAY) {
+				std::string msg = c._str;
+				_room->post([connection, msg](Room& r) { r.say(connection, msg); });
 			}
-			else if(_game)
-				_game->handlePlayerCommand(c, getControlledObjID());
+			else
+				// merged with the other commands of the tick by the room
+				_room->post([connection, c](Room& r) mutable { r.command(connection, c); });
 			break;
 		}
 		case PacketType::ClientHello:
@@ -147,9 +169,48 @@ void Session::handlePacket(sf::Packet& p)
 			}
 			break;
 		}
+		case PacketType::Spectate:
+		{
+			// a player can not turn into a spectator
+			if(_authorized)
+				break;
+			u16 vMajor, vMinor;
+			p >> vMajor >> vMinor >> _spectatorKey >> _spectatedRoom;
+			if(vMajor != u16(myGame_VERSION_MAJOR) || vMinor != u16(myGame_VERSION_MINOR)) {
+				disconnectUnauthorized("Version mismatch.");
+				break;
+			}
+			// the join handler tells the spectators apart by the flag
+			_spectator = true;
+			if(_requestGameJoin(*this))
+				_authorized = true;
+			else {
+				_spectator = false;
+				disconnectUnauthorized("Spectating is not allowed.");
+			}
+			break;
+		}
 		case PacketType::JoinGame:
 		{
-			_requestGameJoin(*this);
+			if(!_spectator)
+				_requestGameJoin(*this);
+			break;
+		}
+		case PacketType::DefineIncantations:
+		{
+			disconnectUnauthorized();
+			if(!_authorized)
+				break;
+			// std::vector<std::string> read by hand - the count is not trusted
+			auto incantations = std::make_shared<std::vector<std::string>>();
+			u32 count = 0;
+			p >> count;
+			std::string incantation;
+			for(u32 i = 0; i < std::min(count, MAX_MEMBER_INCANTATIONS) && (p >> incantation); ++i)
+				incantations->push_back(incantation);
+			u32 connection = _connection;
+			if(_room)
+				_room->post([connection, incantations](Room& r) { r.defineIncantations(connection, *incantations); });
 			break;
 		}
 		default:
@@ -197,14 +258,6 @@ void Session::onAuthorized()
 	_requestGameJoin(*this);
 }
 
-void Session::sendMap(const WorldMap& map)
-{
-	sf::Packet p;
-	//TODO FIXME const_cast
-	p << PacketType::GameInit << Serializer<sf::Packet>(const_cast<WorldMap&>(map));
-	send(p);
-}
-
 ID Session::getControlledObjID() const
 {
 	return _sharedRegistry.getValue<ID>("controlled_object_id");
@@ -229,35 +282,72 @@ void Session::setControlledObjID(ID id)
 	setValue("controlled_object_id", id);
 }
 
-void Session::joinGame(Game& game)
+void Session::joinRoom(Room& room)
 {
-	_game = &game;
-	sendMap(_game->getMap());
-	_game->getRegistry().addObserver(*this);
-	setControlledObjID(_game->addCharacter());
+	_room = &room;
+	u32 connection = _connection;
+	bool spectator = _spectator;
+	_room->post([connection, spectator](Room& r) { r.join(connection, spectator); });
+}
+
+void Session::leaveRoom()
+{
+	u32 connection = _connection;
+	_room->post([connection](Room& r) { r.leave(connection); });
+	onRoomLeft();
 }
 
-void Session::leaveGame()
+void Session::onRoomLeft()
 {
-	ID character = getControlledObjID();
+	_room = nullptr;
 	setControlledObjID(NULLID);
-	_game->removeCharacter(character);
-	send(PacketType::GameOver);
-	_game = nullptr;
+}
+
+Room* Session::getRoom() const
+{
+	return _room;
+}
+
+u32 Session::getConnection() const
+{
+	return _connection;
+}
+
+bool Session::isSpectator() const
+{
+	return _spectator;
+}
+
+const std::string& Session::getSpectatorKey() const
+{
+	return _spectatorKey;
+}
+
+u16 Session::getSpectatedRoom() const
+{
+	return _spectatedRoom;
 }
 
 ////////////////////////////////////////////////////////////
 
-Updater::Updater(Sender s, EntityResolver getEntity): _send{s}, _getEntity{getEntity}, _timeSinceLastUpdateSent{0}
+Updater::Updater(Sender s, EntityResolver getEntity, float updatePeriod): _send{s}, _getEntity{getEntity}, _timeSinceLastUpdateSent{0},
+	_updatePeriod{updatePeriod}, _time{0}, _deadReckoningThreshold{1}
 {}
 
+float Updater::getTime() const
+{
+	return _time;
+}
+
 void Updater::tick(float delta)
 {
+	_time += delta;
 	_timeSinceLastUpdateSent += delta;
-	if(_timeSinceLastUpdateSent >= 0.01) {
+	if(_timeSinceLastUpdateSent >= _updatePeriod) {
 		_timeSinceLastUpdateSent = 0;
 		while(!_updateEventQueue.empty()) {
-			sendEvent(*_updateEventQueue.begin());
+			if(!isPredictedByClients(*_updateEventQueue.begin()))
+				sendEvent(*_updateEventQueue.begin());
 			_updateEventQueue.erase(_updateEventQueue.begin());
 		}
 	}
@@ -277,11 +367,18 @@ void Updater::sendEvent(const EntityEvent& e)
 	auto* entity = _getEntity(e.entityID);
 	if(entity)
 		modifiedComponent = entity->getComponent(e.componentT);
-	sf::Packet p;
-	p << PacketType::WorldUpdate << e;
+	_packet.clear();
+	_packet << PacketType::WorldUpdate << _time << e;
 	if(modifiedComponent && !e.destroyed)
-		p << Serializer<sf::Packet>(*modifiedComponent);
-	_send(p, [](ID){ return true; });
+		_packet << Serializer<sf::Packet>(*modifiedComponent);
+	_send(_packet, [](ID){ return true; });
+
+	if(e.destroyed && (e.componentT == ComponentType::Body || e.componentT == ComponentType::NONE))
+		_sentBodyStates.erase(e.entityID);
+	else if(modifiedComponent && e.componentT == ComponentType::Body) {
+		BodyComponent* bc = static_cast<BodyComponent*>(modifiedComponent);
+		_sentBodyStates[e.entityID] = SentBodyState{_time, bc->getPosition(), bc->getVelocity()};
+	}
 
 	/*
 	cout << "sent an update:\n\tentityID: " << e.entityID 
@@ -291,24 +388,60 @@ void Updater::sendEvent(const EntityEvent& e)
 		*/
 }
 
+bool Updater::isPredictedByClients(const EntityEvent& e)
+{
+	if(e.componentT != ComponentType::Body || e.created || e.destroyed)
+		return false;
+	auto sent = _sentBodyStates.find(e.entityID);
+	Entity* entity = _getEntity(e.entityID);
+	if(sent == _sentBodyStates.end() || !entity)
+		return false;
+	BodyComponent* bc = entity->getComponent<BodyComponent>();
+	CollisionComponent* cc = entity->getComponent<CollisionComponent>();
+	if(!bc || !cc || !cc->isKinematic())
+		return false;
+	const SentBodyState& s = sent->second;
+	if(!bc->getVelocity().equals(s.velocity))
+		return false;
+	vec3f extrapolated = s.position + s.velocity*(_time - s.time);
+	return extrapolated.getDistanceFrom(bc->getPosition()) <= _deadReckoningThreshold;
+}
+
 void Updater::reset()
 {
 	_updateEventQueue.clear();
+	_sentBodyStates.clear();
+}
+
+void Updater::setUpdatePeriod(float seconds)
+{
+	_updatePeriod = seconds;
 }
 
 ////////////////////////////////////////////////////////////
 
-Game::Game(const WorldMap& map): _map{map}, _gameWorld{_map}, _physics{_gameWorld}, _spells{_gameWorld}, _input{_gameWorld, _spells}, _LuaStateGameMode{nullptr},
-	_gameModeEntityEventObserver{[this](const EntityEvent& e){ this->gameModeOnEntityEvent(e); }}, _ended{false}
+Game::Game(const WorldMap& map): _map{map}, _gameWorld{_map}, _spatialIndex{_gameWorld}, _attributeIndex{_gameWorld}, _physics{_gameWorld}, _projectiles{_gameWorld}, _spells{_gameWorld, &_spatialIndex}, _input{_gameWorld, _spells}, _LuaStateGameMode{nullptr},
+	_gmOnPlayerJoined{"onPlayerJoined"}, _gmOnPlayerLeft{"onPlayerLeft"}, _gmOnGameStart{"onGameStart"}, _gmOnEntityEvent{"onEntityEvent"},
+	_gameModeEntityEventObserver{[this](const EntityEvent& e){ this->gameModeOnEntityEvent(e); }}, _ended{false}, _recorder{nullptr},
+	_random{map.getTerrain().getSeed()}
 {
 	_gameWorld.addObserver(*this);
-	_physics.registerCollisionCallback(std::bind(&SpellSystem::collisionCallback, std::ref(_spells), placeholders::_1, placeholders::_2));
+	_gameWorld.addObserver(_spatialIndex);
+	_gameWorld.addObserver(_attributeIndex);
+	// the contacts of the bodies and of the projectiles go to the spells in one batch
+	auto collectContacts = [this](const std::vector<Contact>& contacts) {
+		_contacts.insert(_contacts.end(), contacts.begin(), contacts.end());
+	};
+	_physics.registerContactCallback(collectContacts);
+	_projectiles.registerContactCallback(collectContacts);
 
 	_LuaStateGameMode = luaL_newstate();
 	luaL_openlibs(_LuaStateGameMode);
 	gameModeRegisterAPIMethods();
 	if(luaL_dofile(_LuaStateGameMode, "lua/gamemode_dm.lua"))
 		printf("%s\n", lua_tostring(_LuaStateGameMode, -1));
+	for(LuaFunction* f : gameModeFunctions())
+		f->resolve(_LuaStateGameMode);
 
 	loadMap();
 	gameModeOnGameStart();
@@ -316,21 +449,33 @@ Game::Game(const WorldMap& map): _map{map}, _gameWorld{_map}, _physics{_gameWorl
 
 Game::~Game()
 {
+	for(LuaFunction* f : gameModeFunctions())
+		f->release();
 	lua_close(_LuaStateGameMode);
 }
 
 bool Game::run(float timeDelta)
 {
+	if(_recorder)
+		_recorder->tick(timeDelta);
 	while(!_eventQueue.empty()) {
 		EntityEvent e = _eventQueue.front();
 		_eventQueue.pop();
 		_spells.onMsg(e);
 		_physics.onMsg(e);
+		_projectiles.onMsg(e);
 		_gameModeEntityEventObserver.onMsg(e);
 	}
 
 	_physics.update(timeDelta);
-	_spells.update(timeDelta);
+	// a stall slows down the whole game, not the characters only
+	float simulatedTime = _physics.getSimulatedTime();
+	_projectiles.update(simulatedTime);
+	if(!_contacts.empty()) {
+		_spells.contactCallback(_contacts);
+		_contacts.clear();
+	}
+	_spells.update(simulatedTime);
 
 	return !_ended;
 }
@@ -348,7 +493,7 @@ void Game::loadMap()
 		Entity& te = _gameWorld.createAndGetEntity();
 		te.addComponent<BodyComponent>(t.position);
 		te.addComponent<MeshGraphicsComponent>("Tree1.obj", false);
-		te.addComponent<CollisionComponent>(0.5, 10, vec3f(0,-5.5,0), 0);
+		te.addComponent<CollisionComponent>(0.5, 10, vec3f(0,-5.5,0), 0, false, -10, CollisionLayer::Tree, CollisionLayer::TreeMask);
 		te.getComponent<CollisionComponent>()->setSlippery(true);
 	}
 	for(const Spawnpoint& s: _map.getSpawnpoints()) {
@@ -377,6 +522,9 @@ void Game::gameModeRegisterAPIMethods()
 	lua_pushliteral(L, "AttributeStore"); lua_pushinteger(L, ComponentType::AttributeStore); lua_settable(L, -3);
 	lua_setglobal(L, "ComponentType");
 
+	registerCollisionFilterAPI(L, _gameWorld);
+	registerSpatialQueryAPI(L, _spatialIndex);
+
 	auto callGetEntityAttributeValue = [](lua_State* s)->int {
 		int argc = lua_gettop(s);
 		if(argc != 2)
@@ -430,24 +578,25 @@ void Game::gameModeRegisterAPIMethods()
 			return 0;		
 		}
 		std::string attributeName = lua_tostring(s, 1);
-		std::string attributeValue;
-		if(argc == 2)
-			attributeValue = lua_tostring(s, 2);
 		Game* g = (Game*)lua_touserdata(s, lua_upvalueindex(1));
+		const AttributeIndex& attributes = g->_attributeIndex;
 		std::vector<ID> entities;
-		for(Entity& e : g->_gameWorld.getEntities())
-		{
-			AttributeStoreComponent* asc = e.getComponent<AttributeStoreComponent>();
-			if(asc != nullptr)
-			{
-				if(asc->hasAttribute(attributeName))
-					try {
-						if(attributeValue == "" || asc->getAttribute<std::string>(attributeName) == attributeValue)
-							entities.push_back(e.getID());
-					}
-				catch(std::invalid_argument& e) {
-					std::cerr << "getEntitiesByAttributeValue: AttributeValue must be float or empty string.";
-				}
+		if(argc == 1 || (lua_type(s, 2) == LUA_TSTRING && lua_rawlen(s, 2) == 0)) {
+			auto& r = attributes.getEntities(attributeName);
+			entities.assign(r.begin(), r.end());
+		}
+		// a numeric string ("1") is compared with the string attributes
+		else if(lua_type(s, 2) == LUA_TNUMBER) {
+			auto& r = attributes.getEntities(attributeName, lua_tonumber(s, 2));
+			entities.assign(r.begin(), r.end());
+		}
+		else {
+			// string attributes are not indexed by the value
+			std::string attributeValue = lua_tostring(s, 2);
+			for(ID id : attributes.getEntities(attributeName)) {
+				AttributeStoreComponent* asc = g->_gameWorld.getEntity(id)->getComponent<AttributeStoreComponent>();
+				if(asc->getAttribute<std::string>(attributeName) == attributeValue)
+					entities.push_back(id);
 			}
 		}
 		lua_createtable(s, entities.size(), 0);
@@ -637,57 +786,73 @@ void Game::gameModeRegisterAPIMethods()
 		Game* g = (Game*)lua_touserdata(s, lua_upvalueindex(1));
 		ID entityID = lua_tonumber(s, 1);
 		std::string command = lua_tostring(s, 2);
-		Command c;
-		c._type = Command::Type::STR;
-		c._str = command;
-		g->handlePlayerCommand(c, entityID);
+		// not a player input - it is not recorded, the gamemode issues it again in a replay
+		u32 incantation = g->_spells.defineIncantation(command, false);
+		if(incantation != SpellSystem::NO_INCANTATION)
+			g->_spells.cast(incantation, entityID);
 		return 0;
 	};
 	lua_pushlightuserdata(L, this);
 	lua_pushcclosure(L, callHandlePlayerCommand, 1);
 	lua_setglobal(L, "commandCharacter");
+
+	// the generator of the standard math.random is shared by the whole process (all the rooms),
+	// the game has its own to make the same choices when it is replayed
+	auto callRandom = [](lua_State* s)->int {
+		int argc = lua_gettop(s);
+		Game* g = (Game*)lua_touserdata(s, lua_upvalueindex(1));
+		if(argc == 0) {
+			std::uniform_real_distribution<lua_Number> d(0, 1);
+			lua_pushnumber(s, d(g->_random));
+			return 1;
+		}
+		lua_Integer low = 1, up;
+		if(argc == 1)
+			up = luaL_checkinteger(s, 1);
+		else {
+			low = luaL_checkinteger(s, 1);
+			up = luaL_checkinteger(s, 2);
+		}
+		luaL_argcheck(s, low <= up, argc, "interval is empty");
+		std::uniform_int_distribution<lua_Integer> d(low, up);
+		lua_pushinteger(s, d(g->_random));
+		return 1;
+	};
+	lua_getglobal(L, "math");
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, callRandom, 1);
+	lua_setfield(L, -2, "random");
+	lua_pop(L, 1);
 }
 
 void Game::gameModeOnPlayerJoined(ID character)
 {
-	lua_State* L = _LuaStateGameMode;
-	lua_getglobal(L, "onPlayerJoined");
-	lua_pushinteger(L, character);
-	if(lua_pcall(L, 1, 0, 0) != 0) {
-		cerr << "something went wrong with onPlayerJoined: " << lua_tostring(L, -1) << endl;
-		lua_pop(L, 1);
-	}
+	_gmOnPlayerJoined(character);
 }
 
 void Game::gameModeOnPlayerLeft(ID character)
 {
-	lua_State* L = _LuaStateGameMode;
-	lua_getglobal(L, "onPlayerLeft");
-	lua_pushinteger(L, character);
-	if(lua_pcall(L, 1, 0, 0) != 0) {
-		cerr << "something went wrong with onPlayerLeft: " << lua_tostring(L, -1) << endl;
-		lua_pop(L, 1);
-	}
+	_gmOnPlayerLeft(character);
 }
 
 void Game::gameModeOnGameStart()
 {
-	lua_State* L = _LuaStateGameMode;
-	lua_getglobal(L, "onGameStart");
-	if(lua_pcall(L, 0, 0, 0) != 0) {
-		cerr << "something went wrong with onGameStart: " << lua_tostring(L, -1) << endl;
-	}
+	_gmOnGameStart();
 }
 
 ID Game::addCharacter()
 {
 	ID character = _gameWorld.createCharacter(vec3f(0));
+	if(_recorder)
+		_recorder->playerJoined(character);
 	gameModeOnPlayerJoined(character);
 	return character;
 }
 
 void Game::removeCharacter(ID entityID)
 {
+	if(_recorder)
+		_recorder->playerLeft(entityID);
 	gameModeOnPlayerLeft(entityID);
 	_gameWorld.removeEntity(entityID);
 }
@@ -699,9 +864,23 @@ Entity* Game::getWorldEntity(ID eID)
 
 void Game::handlePlayerCommand(Command& c, ID entity)
 {
+	if(_recorder)
+		_recorder->command(c, entity);
 	_input.handleCommand(c, entity);
 }
 
+u32 Game::defineIncantation(const std::string& incantation)
+{
+	if(_recorder)
+		_recorder->incantation(incantation);
+	return _spells.defineIncantation(incantation);
+}
+
+u32 Game::findIncantation(const std::string& incantation) const
+{
+	return _spells.findIncantation(incantation);
+}
+
 Game::Store& Game::getRegistry()
 {
 	return _registry;
@@ -712,18 +891,54 @@ const WorldMap& Game::getMap() const
 	return _map;
 }
 
+u32 Game::writeSnapshot(sf::Packet& p)
+{
+	return writeWorldSnapshot(p, _gameWorld);
+}
+
+void Game::setPhysicsStep(float seconds)
+{
+	_physics.setStepSize(seconds);
+}
+
+float Game::getPhysicsStep() const
+{
+	return _physics.getStepSize();
+}
+
+void Game::setPhysicsMaxSteps(unsigned steps)
+{
+	_physics.setMaxSteps(steps);
+}
+
+Physics::Stats Game::takePhysicsStats()
+{
+	return _physics.takeStats();
+}
+
+u32 Game::takeScriptFailureC()
+{
+	u32 c = _spells.takeScriptFailureC();
+	for(LuaFunction* f : gameModeFunctions())
+		c += f->takeFailureC();
+	return c;
+}
+
+void Game::setRecorder(MatchRecorder* recorder)
+{
+	_recorder = recorder;
+	if(_recorder)
+		_recorder->map(_map);
+}
+
 void Game::gameModeOnEntityEvent(const EntityEvent& e)
 {
-	lua_State* L = _LuaStateGameMode;
-	lua_getglobal(L, "onEntityEvent");
-	lua_pushinteger(L, e.entityID);
-	lua_pushinteger(L, e.componentT);
-	lua_pushboolean(L, e.created);
-	lua_pushboolean(L, e.destroyed);
-	if(lua_pcall(L, 4, 0, 0) != 0) {
-		cerr << "something went wrong with onEntityEvent: " << lua_tostring(L, -1) << endl;
-		lua_pop(L, 1);
-	}
+	_gmOnEntityEvent(e.entityID, e.componentT, e.created, e.destroyed);
+}
+
+std::vector<LuaFunction*> Game::gameModeFunctions()
+{
+	return {&_gmOnPlayerJoined, &_gmOnPlayerLeft, &_gmOnGameStart, &_gmOnEntityEvent};
 }
 
 void Game::GameModeEntityEventObserver::onMsg(const EntityEvent& e)
@@ -737,13 +952,423 @@ Game::GameModeEntityEventObserver::GameModeEntityEventObserver(EntityEventCallba
 
 ////////////////////////////////////////////////////////////
 
-ServerApplication::ServerApplication(IrrlichtDevice* irrDev)
-	: _irrDevice{irrDev},
-	_updater(std::bind(&ServerApplication::broadcast, ref(*this), placeholders::_1, placeholders::_2),
-			[this](ID entID)->Entity* { if(_game) return _game->getWorldEntity(entID); else return nullptr; })
+Room::Room(unsigned index): _index{index},
+	_updater(std::bind(&Room::broadcast, ref(*this), placeholders::_1, placeholders::_2),
+			[this](ID entID)->Entity* { if(_game) return _game->getWorldEntity(entID); else return nullptr; }),
+	_statsDumpPeriod{0}, _statsDumpTimer{0}, _physicsStep{0}, _physicsMaxSteps{-1}, _running{false}, _tickTime{0}
 {
-	_listener.setBlocking(false);
+	// the first game is created by the main thread
+	newGame();
+}
+
+Room::~Room()
+{
+	stop();
+}
+
+void Room::start()
+{
+	_running = true;
+	_thread = std::thread(&Room::run, this);
+}
+
+void Room::stop()
+{
+	_running = false;
+	if(_thread.joinable())
+		_thread.join();
+}
+
+void Room::post(Task t)
+{
+	std::lock_guard<std::mutex> l(_mutex);
+	_tasks.push_back(std::move(t));
+}
+
+void Room::takeDeliveries(std::vector<Delivery>& out)
+{
+	out.clear();
+	std::lock_guard<std::mutex> l(_mutex);
+	out.swap(_deliveries);
+}
+
+unsigned Room::getIndex() const
+{
+	return _index;
+}
+
+float Room::getTickTime() const
+{
+	return _tickTime;
+}
+
+void Room::setUpdatePeriod(float seconds)
+{
+	_updater.setUpdatePeriod(seconds);
+}
+
+void Room::setStatsDumpPeriod(float seconds)
+{
+	_statsDumpPeriod = seconds;
+}
+
+void Room::setPhysicsStep(float seconds)
+{
+	_physicsStep = seconds;
+	if(_game)
+		_game->setPhysicsStep(seconds);
+}
+
+void Room::setPhysicsMaxSteps(unsigned steps)
+{
+	_physicsMaxSteps = steps;
+	if(_game)
+		_game->setPhysicsMaxSteps(steps);
+}
+
+bool Room::record(std::string fileName)
+{
+	if(!_recorder.open(fileName))
+		return false;
+	if(_game)
+		_game->setRecorder(&_recorder);
+	return true;
+}
+
+void Room::run()
+{
+	sf::Clock c;
+	while(_running)
+	{
+		{
+			std::lock_guard<std::mutex> l(_mutex);
+			_runningTasks.swap(_tasks);
+		}
+		for(Task& t : _runningTasks)
+			t(*this);
+		_runningTasks.clear();
+		applyInputs();
+
+		float timeDelta = c.restart().asSeconds();
+
+		sf::Clock tickClock;
+		if(_game)
+			if(!_game->run(timeDelta))
+				gameOver();
+		sf::Clock encodeClock;
+		_updater.tick(timeDelta);
+		_networkStats.encodeTime(encodeClock.getElapsedTime().asSeconds());
+		_tickTime = _tickTime*0.9f + tickClock.getElapsedTime().asSeconds()*0.1f;
+
+		_networkStats.update(timeDelta);
+		if(_statsDumpPeriod > 0 && (_statsDumpTimer += timeDelta) >= _statsDumpPeriod) {
+			_statsDumpTimer = 0;
+			dumpStats();
+		}
+
+		sf::sleep(sf::milliseconds(50));
+	}
+}
+
+void Room::join(u32 connection, bool spectator)
+{
+	if(!_game || _members.count(connection))
+		return;
+	sf::Clock c;
+	sf::Packet p;
+	p << PacketType::GameInit << Serializer<sf::Packet>(_map) << _game->getPhysicsStep();
+	send(connection, p);
+	// the snapshot goes to this session only, everyone else learns about the new character from the Updater
+	sendSnapshot(connection);
+	p.clear();
+	p << PacketType::GameRegistryUpdate << Serializer<sf::Packet>(static_cast<KeyValueStore&>(_game->getRegistry()));
+	send(connection, p);
+	_members[connection] = Member{NULLID, {}, InputAccumulator()};
+	if(spectator) {
+		std::cout << "Connection " << connection << " spectates room " << _index << std::endl;
+		return;
+	}
+	ID character = _game->addCharacter();
+	_members[connection].character = character;
+	deliver(connection, WireBuffer(), [character](Session& s) { s.setControlledObjID(character); });
+	std::cout << "Connection " << connection << " joined room " << _index << " in " << c.getElapsedTime().asMicroseconds()/1000.f << " ms\n";
+}
+
+void Room::leave(u32 connection)
+{
+	auto m = _members.find(connection);
+	if(m == _members.end())
+		return;
+	ID character = m->second.character;
+	_members.erase(m);
+	if(_game && character != NULLID)
+		_game->removeCharacter(character);
+}
+
+void Room::command(u32 connection, Command& c)
+{
+	auto m = _members.find(connection);
+	if(!_game || m == _members.end() || m->second.character == NULLID)
+		return;
+	if(c._seq != 0)
+		m->second.lastInputSeq = c._seq;
+	if(c._type == Command::Type::CAST) {
+		// the game knows the incantation by its own ID
+		const std::vector<u32>& incantations = m->second.incantations;
+		if(c._u32 >= incantations.size() || incantations[c._u32] == SpellSystem::NO_INCANTATION)
+			return;
+		c._u32 = incantations[c._u32];
+	}
+	m->second.input.add(c);
+}
+
+void Room::applyInputs()
+{
+	if(!_game)
+		return;
+	// the tick about to be simulated starts now
+	float time = _updater.getTime();
+	for(auto& m : _members) {
+		ID character = m.second.character;
+		m.second.input.flush([this, character](Command& c) { _game->handlePlayerCommand(c, character); });
+		if(m.second.lastInputSeq != m.second.ackedInputSeq) {
+			// the client replays its later commands on top of the states this tick and the next ones send
+			sf::Packet p;
+			p << PacketType::InputAck << m.second.lastInputSeq << time;
+			send(m.first, p);
+			m.second.ackedInputSeq = m.second.lastInputSeq;
+		}
+	}
+}
+
+void Room::defineIncantations(u32 connection, const std::vector<std::string>& incantations)
+{
+	auto m = _members.find(connection);
+	if(!_game || m == _members.end() || m->second.character == NULLID)
+		return;
+	Member& member = m->second;
+	member.incantations.clear();
+	for(std::size_t i = 0; i < incantations.size() && i < MAX_MEMBER_INCANTATIONS; ++i) {
+		u32 id = _game->findIncantation(incantations[i]);
+		if(id == SpellSystem::NO_INCANTATION && member.addedIncantationC < MEMBER_INCANTATION_SHARE) {
+			id = _game->defineIncantation(incantations[i]);
+			if(id != SpellSystem::NO_INCANTATION)
+				++member.addedIncantationC;
+		}
+		member.incantations.push_back(id);
+	}
+}
+
+void Room::say(u32 connection, std::string msg)
+{
+	auto m = _members.find(connection);
+	if(!_game || m == _members.end())
+		return;
+	std::string name;
+	Entity* e;
+	AttributeStoreComponent* as;
+	if((e = _game->getWorldEntity(m->second.character)) &&
+			(as = e->getComponent<AttributeStoreComponent>()) &&
+			(as->hasAttribute("name")))
+		name = as->getAttribute<std::string>("name");
+	if(name.length() > 0)
+		msg = name + ": " + msg;
+	sf::Packet p;
+	p << PacketType::Message << std::string("{all}")+msg;
+	std::cout << "MESSAGE (room " << _index << "): " << msg << std::endl;
+	broadcast(p, [](ID)->bool{ return true; });
+}
+
+void Room::onMsg(const KeyValueStoreChange<PacketType>& m)
+{
+	sf::Packet p;
+	p << m.typeID << Serializer<sf::Packet>(*static_cast<KeyValueStore*>(m.store));
+	broadcast(p, [](ID)->bool{ return true; });
+}
+
+void Room::send(u32 connection, sf::Packet& p, SessionCallback apply)
+{
+	deliver(connection, framePacket(p), apply);
+}
+
+void Room::deliver(u32 connection, WireBuffer b, SessionCallback apply)
+{
+	std::lock_guard<std::mutex> l(_mutex);
+	_deliveries.push_back(Delivery{connection, std::move(b), std::move(apply)});
+}
+
+void Room::broadcast(sf::Packet& p, ClientFilterPredicate fp)
+{
+	// encoded once, all the members get the same buffer
+	WireBuffer b = framePacket(p);
+	_networkStats.packetSent(peekPacketType(b), b.size(), peekUpdatedComponentType(b));
+	std::lock_guard<std::mutex> l(_mutex);
+	for(auto& m : _members)
+		if(fp(m.second.character))
+			_deliveries.push_back(Delivery{m.first, b, SessionCallback()});
+}
+
+void Room::sendSnapshot(u32 connection)
+{
+	sf::Clock c;
+	sf::Packet p;
+	p << PacketType::WorldSnapshot;
+	u32 entityC = _game->writeSnapshot(p);
+	float buildTime = c.getElapsedTime().asSeconds();
+	send(connection, p);
+	std::cout << "Sent world snapshot to connection " << connection << ": " << entityC << " entities, "
+		<< p.getDataSize() << " bytes, built in " << buildTime*1000 << " ms\n";
+}
+
+void Room::gameOver()
+{
+	// the players have to join again, the spectators watch the next game right away
+	std::vector<u32> spectators;
+	for(auto& m : _members) {
+		sf::Packet p;
+		p << PacketType::GameOver;
+		if(m.second.character == NULLID) {
+			spectators.push_back(m.first);
+			send(m.first, p);
+			continue;
+		}
+		_game->removeCharacter(m.second.character);
+		send(m.first, p, [](Session& s) { s.onRoomLeft(); });
+	}
+	_members.clear();
+	_game.reset();
+	_updater.reset();
 	newGame();
+	for(u32 connection : spectators)
+		join(connection, true);
+}
+
+void Room::newGame()
+{
+	_map.generate(vec2u(64),
+#ifdef DEBUG_BUILD
+	1
+#else
+	std::random_device()()
+#endif
+	);
+	_game.reset(new Game(_map));
+	_game->addObserver(_updater);
+	_game->getRegistry().addObserver(*this);
+	_game->setRecorder(&_recorder);
+	if(_physicsStep > 0)
+		_game->setPhysicsStep(_physicsStep);
+	if(_physicsMaxSteps >= 0)
+		_game->setPhysicsMaxSteps(_physicsMaxSteps);
+}
+
+void Room::dumpStats()
+{
+	// one write, the rooms dump from their threads
+	std::stringstream name, o;
+	name << "room " << _index << " broadcast";
+	_networkStats.dump(o, name.str());
+	u32 merged = 0, dropped = 0;
+	for(auto& m : _members) {
+		merged += m.second.input.takeMergedC();
+		dropped += m.second.input.takeDroppedC();
+	}
+	o << "room " << _index << " input: " << merged << " commands merged, " << dropped << " dropped\n";
+	if(_game) {
+		Physics::Stats ps = _game->takePhysicsStats();
+		o << "room " << _index << " physics: " << ps.steps << " steps (" << ps.coarseSteps << " coarse) in " << ps.updates << " ticks, "
+			<< ps.time*1000 << " ms, tick avg " << (ps.updates ? ps.time/ps.updates*1000 : 0) << " ms, max " << ps.maxTime*1000
+			<< " ms, " << ps.droppedTime << " s dropped\n";
+		o << "room " << _index << " scripts: " << _game->takeScriptFailureC() << " failed calls\n";
+	}
+	cout << o.str();
+}
+
+////////////////////////////////////////////////////////////
+
+ServerApplication::ServerApplication(IrrlichtDevice* irrDev, unsigned roomCount)
+	: _irrDevice{irrDev}, _nextConnection{1}, _statsDumpPeriod{0}, _statsDumpTimer{0}, _routerConnected{false}, _loadReportTimer{0}
+{
+	_listener.setBlocking(false);
+	for(unsigned i = 0; i < std::max(roomCount, 1u); ++i)
+		_rooms.emplace_back(new Room(i));
+}
+
+void ServerApplication::setStatsDumpPeriod(float seconds)
+{
+	_statsDumpPeriod = seconds;
+	for(auto& r : _rooms)
+		r->setStatsDumpPeriod(seconds);
+}
+
+bool ServerApplication::record(std::string fileName)
+{
+	for(auto& r : _rooms)
+		if(!r->record(_rooms.size() == 1 ? fileName : fileName + "." + std::to_string(r->getIndex())))
+			return false;
+	return true;
+}
+
+bool ServerApplication::registerAtRouter(std::string host, unsigned short controlPort, std::string advertisedAddress, unsigned short port)
+{
+	if(_router.connect(host, controlPort) != sf::Socket::Done)
+		return false;
+	sf::Packet p;
+	p << PacketType::BackendRegister << advertisedAddress << u16(port);
+	_routerConnected = _router.send(p) == sf::Socket::Done;
+	_router.setBlocking(false);
+	return _routerConnected;
+}
+
+void ServerApplication::setSpectatorKey(std::string key)
+{
+	_spectatorKey = key;
+}
+
+void ServerApplication::reportLoad()
+{
+	u32 players = 0;
+	for(Session& s : _sessions)
+		players += s.getRoom() != nullptr && !s.isSpectator();
+	float tickTime = 0;
+	for(auto& r : _rooms)
+		tickTime += r->getTickTime();
+	tickTime /= _rooms.size();
+	sf::Packet p;
+	p << PacketType::BackendLoad << players << tickTime;
+	sf::Socket::Status r;
+	while((r = _router.send(p)) == sf::Socket::Status::Partial);
+	if(r == sf::Socket::Status::Disconnected || r == sf::Socket::Status::Error) {
+		cerr << "Lost the connection to the router.\n";
+		_routerConnected = false;
+	}
+}
+
+void ServerApplication::dumpStats()
+{
+	for(auto& s : _sessions) {
+		std::stringstream name;
+		name << "session " << s;
+		s.getStats().dump(cout, name.str());
+	}
+}
+
+void ServerApplication::setUpdatePeriod(float seconds)
+{
+	for(auto& r : _rooms)
+		r->setUpdatePeriod(seconds);
+}
+
+void ServerApplication::setPhysicsStep(float seconds)
+{
+	for(auto& r : _rooms)
+		r->setPhysicsStep(seconds);
+}
+
+void ServerApplication::setPhysicsMaxSteps(unsigned steps)
+{
+	for(auto& r : _rooms)
+		r->setPhysicsMaxSteps(steps);
 }
 
 bool ServerApplication::listen(short port)
@@ -753,13 +1378,18 @@ bool ServerApplication::listen(short port)
 
 void ServerApplication::run()
 {
+	for(auto& r : _rooms)
+		r->start();
 	sf::Clock c;
 	while(true)
 	{
 		acceptClient();
+		for(auto& s : _sessions)
+			while(s.receive());
+		deliver();
 		for(auto s = _sessions.begin(); s != _sessions.end(); s++)
 		{
-			while(s->receive());
+			s->flushSendQueue();
 			if(s->isClosed())
 			{
 				onClientDisconnect(_sessions.iteratorToIndex(s));
@@ -768,17 +1398,41 @@ void ServerApplication::run()
 		}
 
 		float timeDelta = c.restart().asSeconds();
+		for(auto& s : _sessions)
+			s.getStats().update(timeDelta);
+		if(_statsDumpPeriod > 0 && (_statsDumpTimer += timeDelta) >= _statsDumpPeriod) {
+			_statsDumpTimer = 0;
+			dumpStats();
+		}
+		if(_routerConnected && (_loadReportTimer += timeDelta) >= 1) {
+			_loadReportTimer = 0;
+			reportLoad();
+		}
 
-		if(_game)
-			if(!_game->run(timeDelta))
-				gameOver();
-		_updater.tick(timeDelta);
-
-		sf::sleep(sf::milliseconds(50));
+		// just the network I/O here, the games tick on the room threads
+		sf::sleep(sf::milliseconds(10));
 		_irrDevice->getVideoDriver()->endScene();
 	}
 }
 
+void ServerApplication::deliver()
+{
+	for(auto& r : _rooms) {
+		r->takeDeliveries(_deliveries);
+		for(Room::Delivery& d : _deliveries) {
+			auto c = _connections.find(d.connection);
+			if(c == _connections.end())
+				continue; // disconnected meanwhile
+			Session& s = _sessions[c->second];
+			if(d.apply)
+				d.apply(s);
+			if(!d.buffer.empty())
+				s.send(d.buffer);
+		}
+		_deliveries.clear();
+	}
+}
+
 void ServerApplication::acceptClient()
 {
 	unique_ptr<sf::TcpSocket> sock(new sf::TcpSocket);
@@ -788,60 +1442,54 @@ void ServerApplication::acceptClient()
 		onClientConnect(std::move(sock));
 }
 
-void ServerApplication::broadcast(sf::Packet& p, ClientFilterPredicate fp)
-{
-	for(auto& s : _sessions)
-		if(fp(s.getControlledObjID()))
-			s.send(p);
-}
-
 void ServerApplication::onClientConnect(std::unique_ptr<sf::TcpSocket>&& sock)
 {
 	cout << "Client connected from " << sock->getRemoteAddress() << endl;
-	_sessions.emplace(std::move(sock), [this](Session& s){ return requestGameJoin(s); }, [this](sf::Packet& p, ClientFilterPredicate fp){ broadcast(p, fp); });
+	u32 connection = _nextConnection++;
+	ID sessionID = _sessions.emplace(std::move(sock), connection, [this](Session& s){ return requestGameJoin(s); });
+	_connections[connection] = sessionID;
 }
 
 void ServerApplication::onClientDisconnect(ID sessionID)
 {
 	Session& s = _sessions[sessionID];
 	cout << "Client disconnected: " << s << endl;
+	_connections.erase(s.getConnection());
 	_sessions.remove(sessionID);
 }
 
 ServerApplication::~ServerApplication()
 {
 	_listener.close();
+	for(auto& r : _rooms)
+		r->stop();
 }
 
 bool ServerApplication::requestGameJoin(Session& s)
 {
-	if(_game) {
-		s.joinGame(*_game);
-		_game->sendHelloMsgTo(_updater); // TODO send updates only to newly connected client
+	if(s.getRoom())
+		return false;
+	if(s.isSpectator()) {
+		if(_spectatorKey.empty() || s.getSpectatorKey() != _spectatorKey)
+			return false;
+		Room& room = *_rooms[s.getSpectatedRoom() < _rooms.size() ? s.getSpectatedRoom() : 0];
+		std::cout << "Client " << s << " spectates room " << room.getIndex() << std::endl;
+		s.joinRoom(room);
 		return true;
 	}
-	else
-		return false;
-}
-
-void ServerApplication::gameOver()
-{
-	for(Session& s : _sessions)
-		s.leaveGame();
-	_game.reset();
-	_updater.reset();
-	newGame();
-}
-
-void ServerApplication::newGame()
-{
-	_map.generate(vec2u(64),
-#ifdef DEBUG_BUILD
-	1
-#else
-	std::random_device()()
-#endif
-	);
-	_game.reset(new Game(_map));
-	_game->addObserver(_updater);
+	// the least occupied room
+	Room* room = nullptr;
+	unsigned roomSessionC = 0;
+	for(auto& r : _rooms) {
+		unsigned c = 0;
+		for(Session& other : _sessions)
+			c += other.getRoom() == r.get() && !other.isSpectator();
+		if(!room || c < roomSessionC) {
+			room = r.get();
+			roomSessionC = c;
+		}
+	}
+	std::cout << "Client " << s << " joins room " << room->getIndex() << std::endl;
+	s.joinRoom(*room);
+	return true;
 }
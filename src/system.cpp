@@ -1,12 +1,17 @@
 #define _USE_MATH_DEFINES
+#include <chrono>
+#include <cctype>
 #include "CGUITTFont.h"
 #include "system.hpp"
 #include "heightmapMesh.hpp"
 #include "terrainTexturer.hpp"
 #include "CProgressBarSceneNode.hpp"
 
-const float CHARACTER_MAX_STRAFE_FORCE = 600000;
-const float CHARACTER_MAX_VELOCITY = 5;
+const float CHARACTER_ROTATION_SPEED = 3; // radians per second
+const float MAX_STEP_STRETCH = 2; // how much longer the steps may get over the budget
+const float MAP_BORDER_PADDING = 1; // the fence is this far from the edge of the map
+const u32 MAX_INCANTATIONS = 1024; // per game, the incantations of the clients are kept until the game ends
+const std::size_t MAX_INCANTATION_LENGTH = 256;
 
 class CSceneNodeAnimatorVisibilityTimeout: public scene::ISceneNodeAnimator
 {
@@ -88,11 +93,14 @@ class DebugDrawer: public btIDebugDraw
 class MyMotionState : public btMotionState
 {
 	protected:
-		std::function<Entity*()> _getEntity;
 		btRigidBody* _body;
 
 	public:
-		MyMotionState(std::function<Entity*()> getEntity): _getEntity{getEntity}, _body{nullptr}
+		// set by Physics (see Physics::refreshComponentHandles)
+		BodyComponent* bc;
+		CollisionComponent* cc;
+
+		MyMotionState(): _body{nullptr}, bc{nullptr}, cc{nullptr}
 		{}
 
 		virtual ~MyMotionState()
@@ -101,12 +109,7 @@ class MyMotionState : public btMotionState
 
 		virtual void getWorldTransform(btTransform& worldTrans) const
 		{
-			Entity* e;
-			BodyComponent* bc;
-			CollisionComponent* cc;
-			if((e = _getEntity()) &&
-					(bc = e->getComponent<BodyComponent>()) &&
-					(cc = e->getComponent<CollisionComponent>())) {
+			if(bc && cc) {
 				worldTrans.setOrigin(V3f2btV3f(bc->getPosition() - cc->getPosOffset()));
 				worldTrans.setRotation(Q2btQ(bc->getRotation()));
 			}
@@ -114,14 +117,7 @@ class MyMotionState : public btMotionState
 
 		virtual void setWorldTransform(const btTransform& worldTrans)
 		{
-			auto e = _getEntity();
-			if(!e)
-				return;
-			auto bc = e->getComponent<BodyComponent>();
-			if(!bc)
-				return;
-			auto cc = e->getComponent<CollisionComponent>();
-			if(!cc)
+			if(!bc || !cc)
 				return;
 			/*
 			btQuaternion rot = worldTrans.getRotation();
@@ -165,7 +161,7 @@ System::System(World& world): _world{world}
 
 ////////////////////////////////////////////////////////////
 
-Physics::Physics(World& world, scene::ISceneManager* smgr): System{world}, _tAcc{0}, _updating{false}, _heightMap{nullptr}
+Physics::Physics(World& world, scene::ISceneManager* smgr): System{world}, _tAcc{0}, _stepSize{0.01}, _maxSteps{10}, _simulatedTime{0}, _updating{false}, _heightMap{nullptr}
 {
 	btBroadphaseInterface* broadphase = new btDbvtBroadphase();
 	btDefaultCollisionConfiguration* collisionConfiguration = new btDefaultCollisionConfiguration();
@@ -230,124 +226,140 @@ Physics::Physics(World& world, scene::ISceneManager* smgr): System{world}, _tAcc
 	btDefaultMotionState* terrMS = new btDefaultMotionState(tr);
 	btRigidBody::btRigidBodyConstructionInfo terrCI(0.0, terrMS, terrS);
 	btRigidBody* terrB = new btRigidBody(terrCI);
-	_physicsWorld->addRigidBody(terrB);
+	_physicsWorld->addRigidBody(terrB, CollisionLayer::Terrain, CollisionLayer::All);
 	terrB->setUserIndex(ObjStaticID::Map);
 	terrB->setAnisotropicFriction(btVector3(0.4,0.01,0.4));
 	//terrB->setFriction(1);
 	
 	// create fence around the map
-	const float padding = 1;
-	_physicsWorld->addCollisionObject(new btRigidBody(0, nullptr, new btStaticPlaneShape(btVector3(1, 0, 0), padding)));
-	_physicsWorld->addCollisionObject(new btRigidBody(0, nullptr, new btStaticPlaneShape(btVector3(-1, 0, 0), -int(w)+1+padding)));
-	_physicsWorld->addCollisionObject(new btRigidBody(0, nullptr, new btStaticPlaneShape(btVector3(0, 0, 1), padding)));
-	_physicsWorld->addCollisionObject(new btRigidBody(0, nullptr, new btStaticPlaneShape(btVector3(0, 0, -1), -int(w)+1+padding)));
+	const float padding = MAP_BORDER_PADDING;
+	_physicsWorld->addCollisionObject(new btRigidBody(0, nullptr, new btStaticPlaneShape(btVector3(1, 0, 0), padding)), CollisionLayer::Terrain, CollisionLayer::All);
+	_physicsWorld->addCollisionObject(new btRigidBody(0, nullptr, new btStaticPlaneShape(btVector3(-1, 0, 0), -int(w)+1+padding)), CollisionLayer::Terrain, CollisionLayer::All);
+	_physicsWorld->addCollisionObject(new btRigidBody(0, nullptr, new btStaticPlaneShape(btVector3(0, 0, 1), padding)), CollisionLayer::Terrain, CollisionLayer::All);
+	_physicsWorld->addCollisionObject(new btRigidBody(0, nullptr, new btStaticPlaneShape(btVector3(0, 0, -1), -int(w)+1+padding)), CollisionLayer::Terrain, CollisionLayer::All);
+}
+
+Physics::~Physics()
+{
+	for(std::size_t id = 0; id < _bindings.size(); ++id)
+		unbindBody(id);
+	for(Binding& b : _bodyPool) {
+		delete b.motionState;
+		delete b.body;
+	}
 }
 
 vec3f Physics::getObjVelocity(ID objID)
 {
-	auto co = getCollisionObjectByID(objID);
-	if(!co)
+	Binding* b = getBinding(objID);
+	if(!b || !b->character)
 		return vec3f(0);
-	auto dco = dynamic_cast<btRigidBody*>(co);
-	if(!dco)
-		return vec3f(0);
-	auto v = dco->getLinearVelocity();
-	return vec3f(v.x(), v.y(), v.z());
+	return b->controller.getVelocity();
 }
 
 void Physics::update(float timeDelta)
 {
 	_updating = true;
 	auto unsetUpdating = std::unique_ptr<void, std::function<void(void*)>>(this, [this](void*) { _updating = false; });
-	static unsigned fn = 0;
-	float dt = 0.01;
+	auto start = std::chrono::steady_clock::now();
+	float dt = _stepSize;
 	_tAcc += timeDelta;
-
-	timeDelta = 0;
-	while(_tAcc >= dt)
-	{
-		_physicsWorld->stepSimulation(dt, 1, dt);
-		bodyDoStrafe(dt);
-		moveKinematics(dt);
-		timeDelta += dt;
-		_tAcc -= dt;
-		fn++;
+	refreshComponentHandles();
+
+	unsigned steps = _tAcc/dt;
+	if(_maxSteps && steps > _maxSteps) {
+		// spiral of death - more steps would only make the next update later
+		steps = _maxSteps;
+		dt = std::min(_tAcc/steps, _stepSize*MAX_STEP_STRETCH);
+		if(dt > _stepSize)
+			_stats.coarseSteps += steps;
+		_stats.droppedTime += std::max(0.f, _tAcc - steps*dt);
+		_tAcc = 0;
 	}
-	callCollisionCBs();
+	else
+		_tAcc -= steps*dt;
+	for(unsigned i = 0; i < steps; ++i)
+		moveCharacters(dt);
+	_simulatedTime = steps*dt;
+	// nothing is simulated by Bullet, the contacts only
+	_physicsWorld->performDiscreteCollisionDetection();
+	collectContacts();
 	_physicsWorld->debugDrawWorld();
+
+	float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	++_stats.updates;
+	_stats.steps += steps;
+	_stats.time += time;
+	_stats.maxTime = std::max(_stats.maxTime, time);
 }
 
-void Physics::bodyDoStrafe(float timeDelta)
+void Physics::moveCharacters(float timeDelta)
 {
-	//TODO do this only for the bodies that collide with terrain (could be called from collision checking)
-	for(auto& e: _world.getEntities())
-	{
-		auto bc = e.getComponent<BodyComponent>();
-		if(!bc)
-			continue;
-		auto o = getCollisionObjectByID(e.getID());
-		if(!o)
-			continue;
-		btRigidBody* b = dynamic_cast<btRigidBody*>(o);
-		if(!b)
-			continue;
-		float vel = b->getLinearVelocity().length();
-		float velRoof = max(0.f, CHARACTER_MAX_VELOCITY-vel)/CHARACTER_MAX_VELOCITY;
-		vec3f currentDir = (btV3f2V3f(b->getLinearVelocity())*vec3f(1,0,1)).normalize();
-
-		vec2f strDir = bc->getStrafeDir();
-		vec3f dir{strDir.X, 0, strDir.Y};
-		vec3f rot;
-		bc->getRotation().toEuler(rot);
-		rot *= 180/PI;
-		dir.rotateYZBy(-rot.X);
-		dir.rotateXZBy(-rot.Y);
-		dir.rotateXYBy(-rot.Z);
-		dir.Y = 0;
-		dir.normalize();
+	for(Binding& bi: _bindings)
+		if(bi.character)
+			moveCharacter(bi, timeDelta);
+}
 
-		if(dir.getLength() > 0.1)
-		{
-			b->setFriction(1);
-			if(_objData[e.getID()].onGround) {
-				// if holding WD and already going forward at full speed, try to turn as much as possible
-				float changingDir = 1-max(0.f, currentDir.dotProduct(dir));
-				if(changingDir > 0.1) {
-					dir = dir-currentDir;
-					changingDir = 1-max(0.f, currentDir.dotProduct(dir));
-				}
-				float force = CHARACTER_MAX_STRAFE_FORCE*lerp(velRoof, 1, changingDir);
-				b->applyCentralForce(btVector3(dir.X, 0., dir.Z)*force*timeDelta);
-			}
-		}
-		else
-		{
-			b->setFriction(5);
-		}
+void Physics::moveCharacter(Binding& bi, float timeDelta)
+{
+	BodyComponent* bc = bi.motionState->bc;
+	CollisionComponent* cc = bi.motionState->cc;
+	if(!bc || !cc)
+		return;
+	if(bc->getRotDir() != 0) {
+		btQuaternion turn(btVector3(0, 1, 0), bc->getRotDir()*CHARACTER_ROTATION_SPEED*timeDelta);
+		bc->setRotation(btQ2Q(turn*Q2btQ(bc->getRotation())));
 	}
+
+	// strafe direction is relative to the rotation
+	vec2f strDir = bc->getStrafeDir();
+	vec3f dir{strDir.X, 0, strDir.Y};
+	vec3f rot;
+	bc->getRotation().toEuler(rot);
+	rot *= 180/PI;
+	dir.rotateYZBy(-rot.X);
+	dir.rotateXZBy(-rot.Y);
+	dir.rotateXYBy(-rot.Z);
+	dir.Y = 0;
+	if(dir.getLength() > 0.1)
+		dir.normalize();
+	else
+		dir = vec3f(0);
+
+	bi.controller.step(*_physicsWorld, *bi.body, dir, cc->getGravity(), timeDelta);
+	bc->setPosition(btV3f2V3f(bi.body->getWorldTransform().getOrigin()) + cc->getPosOffset());
 }
 
-void Physics::moveKinematics(float timeDelta)
+// sorts and deduplicates now, compares it with last and swaps them
+static void diffContacts(std::vector<std::pair<ID, ID>>& last, std::vector<std::pair<ID, ID>>& now, std::vector<Contact>& contacts)
 {
-	for(auto& e: _world.getEntities())
-	{
-		auto cc = e.getComponent<CollisionComponent>();
-		auto bc = e.getComponent<BodyComponent>();
-		if(bc && cc)
-			if(cc->isKinematic())
-			{
-				vec3f p = bc->getPosition();
-				p += bc->getVelocity()*timeDelta;
-				bc->setPosition(p);
-			}
+	std::sort(now.begin(), now.end());
+	now.erase(std::unique(now.begin(), now.end()), now.end());
+
+	contacts.clear();
+	auto n = now.begin();
+	auto l = last.begin();
+	while(n != now.end() || l != last.end()) {
+		if(l == last.end() || (n != now.end() && *n < *l)) {
+			contacts.push_back(Contact{n->first, n->second, ContactState::Begin});
+			++n;
+		}
+		else if(n == now.end() || *l < *n) {
+			contacts.push_back(Contact{l->first, l->second, ContactState::End});
+			++l;
+		}
+		else {
+			contacts.push_back(Contact{n->first, n->second, ContactState::Persist});
+			++n;
+			++l;
+		}
 	}
-
+	last.swap(now);
 }
 
-void Physics::callCollisionCBs()
+void Physics::collectContacts()
 {
-	for(auto& d : _objData)
-		d.second.onGround = false;
+	_touchingNow.clear();
 	int numManifolds = _physicsWorld->getDispatcher()->getNumManifolds();
 	for (int i = 0; i < numManifolds; i++)
 	{
@@ -358,16 +370,18 @@ void Physics::callCollisionCBs()
 		int numContacts = contactManifold->getNumContacts();
 		if(numContacts > 0)
 		{
-			int obj0ID = obA->getUserIndex();
-			int obj1ID = obB->getUserIndex();
-			if(obj0ID == ObjStaticID::Map)
-				_objData[obj1ID].onGround = true;	
-			if(obj1ID == ObjStaticID::Map)
-				_objData[obj0ID].onGround = true;	
-			for(auto& colCB : _collCallbacks)
-				colCB(obj0ID, obj1ID);
+			// the fence has no ID (-1), it is reported as NULLID
+			ID obj0ID = obA->getUserIndex();
+			ID obj1ID = obB->getUserIndex();
+			_touchingNow.push_back(std::minmax(obj0ID, obj1ID));
 		}
 	}
+	// one pair can have more manifolds
+	diffContacts(_touching, _touchingNow, _contacts);
+
+	if(!_contacts.empty())
+		for(auto& cb : _contactCallbacks)
+			cb(_contacts);
 }
 
 void Physics::onMsg(const EntityEvent& m)
@@ -376,87 +390,571 @@ void Physics::onMsg(const EntityEvent& m)
 	{
 		Entity* e;
 		CollisionComponent* cc;
-		btCollisionObject* o;
+		btRigidBody* rigB;
 		BodyComponent* b;
 		if(!_updating &&
+				(rigB = getBodyByID(m.entityID)) &&
 				(e = _world.getEntity(m.entityID)) &&
 				(cc = e->getComponent<CollisionComponent>()) &&
-				(o = getCollisionObjectByID(m.entityID)) &&
 				(b = e->getComponent<BodyComponent>())) {
-			auto rigB = dynamic_cast<btRigidBody*>(o);
-			auto v = b->getVelocity();
-			float rotSpeed = 3;
-			//_physicsWorld->removeCollisionObject(rigB);
 			auto tr = btTransform(Q2btQ(b->getRotation()), V3f2btV3f(b->getPosition()-cc->getPosOffset()));
 			rigB->setWorldTransform(tr);
-			rigB->setAngularVelocity(btVector3(0, b->getRotDir()*rotSpeed, 0));
-			//_physicsWorld->addCollisionObject(rigB);
 		}
 	}
 	if(m.componentT == ComponentType::Body && (m.created || m.destroyed)
 			|| m.componentT == ComponentType::Collision)
 	{
 		auto eID = m.entityID;
-		btCollisionObject* o = getCollisionObjectByID(eID);
-		if(o)
-			_physicsWorld->removeCollisionObject(o);
 		Entity* e;
 		CollisionComponent* col;
+		BodyComponent* bc;
+		// the kinematic bodies are simulated by ProjectileSystem
 		if(!m.destroyed &&
 				(e = _world.getEntity(eID)) &&
-				(e->hasComponent<BodyComponent>()) &&
-				(col = e->getComponent<CollisionComponent>())) {
-			btScalar mass = col->getMass();
-			btScalar iner = 1;
-			btVector3 fallInertia(iner, iner, iner);
-
-			_objData.emplace(eID, ObjData{});
-			btCollisionShape* pShape = new btCapsuleShape(col->getRadius(), col->getHeight());
-			pShape->calculateLocalInertia(mass,fallInertia);
-			MyMotionState* motionState = new MyMotionState([this, eID]()->Entity* { return _world.getEntity(eID); });
-			btRigidBody::btRigidBodyConstructionInfo bodyCI(mass,motionState,pShape,fallInertia);
-			btRigidBody* body = new btRigidBody(bodyCI);
-			motionState->setBody(body);
-			_physicsWorld->addRigidBody(body);
-			body->setUserIndex(eID);
-			if(col->isKinematic())
-				body->setCollisionFlags(body->getCollisionFlags() |	btCollisionObject::CF_NO_CONTACT_RESPONSE | btCollisionObject::CF_KINEMATIC_OBJECT);
-			body->setActivationState(DISABLE_DEACTIVATION);
-			body->setAngularFactor(btVector3(0,0,0));
-			body->setGravity(btVector3(0,col->getGravity(),0));
-			if(col->isSlippery())
-				body->setAnisotropicFriction(btVector3(0,0,0));
+				(bc = e->getComponent<BodyComponent>()) &&
+				(col = e->getComponent<CollisionComponent>()) &&
+				!col->isKinematic()) {
+			Binding* b = getBinding(eID);
+			if(b) {
+				b->motionState->bc = bc;
+				b->motionState->cc = col;
+				updateBody(*b, *col, m.componentT == ComponentType::Body);
+			}
+			else
+				createBody(eID, *bc, *col);
 		}
+		else
+			unbindBody(eID);
 	}
 }
 
-btCollisionObject* Physics::getCollisionObjectByID(ID entityID)
+btCollisionShape* Physics::getShape(ShapeType type, float radius, float height)
 {
-	for(int i = 0; i < _physicsWorld->getNumCollisionObjects(); i++)
-	{
-		auto obj = _physicsWorld->getCollisionObjectArray()[i];
-		if(obj->getUserIndex() == entityID)
-			return obj;
+	auto& s = _shapes[ShapeKey(type, radius, height)];
+	if(!s)
+		switch(type)
+		{
+			case ShapeType::Capsule:
+				s.reset(new btCapsuleShape(radius, height));
+				break;
+		}
+	return s.get();
+}
+
+void Physics::createBody(ID eID, BodyComponent& bc, CollisionComponent& col)
+{
+	btCollisionShape* pShape = getShape(ShapeType::Capsule, col.getRadius(), col.getHeight());
+
+	Binding pooled;
+	if(!_bodyPool.empty()) {
+		pooled = _bodyPool.back();
+		_bodyPool.pop_back();
+	}
+	else
+		pooled.motionState = new MyMotionState();
+	MyMotionState* motionState = pooled.motionState;
+	// the body reads its initial transform through the motion state
+	motionState->bc = &bc;
+	motionState->cc = &col;
+	btRigidBody::btRigidBodyConstructionInfo bodyCI(0, motionState, pShape);
+	btRigidBody* body;
+	if(pooled.body) {
+		// same state as a new body, without the allocation
+		body = pooled.body;
+		body->~btRigidBody();
+		new (body) btRigidBody(bodyCI);
+	}
+	else
+		body = new btRigidBody(bodyCI);
+	motionState->setBody(body);
+	_physicsWorld->addRigidBody(body, col.getLayer(), col.getMask());
+	setupBody(body, col);
+	bindBody(eID, body, motionState, col.getMass() != 0);
+}
+
+void Physics::updateBody(Binding& b, CollisionComponent& col, bool resetTransform)
+{
+	btRigidBody* body = b.body;
+	btCollisionShape* shape = getShape(ShapeType::Capsule, col.getRadius(), col.getHeight());
+	bool character = col.getMass() != 0;
+	btBroadphaseProxy* proxy = body->getBroadphaseHandle();
+	bool filterChanged = u16(proxy->m_collisionFilterGroup) != col.getLayer() || u16(proxy->m_collisionFilterMask) != col.getMask();
+	bool reinsert = shape != body->getCollisionShape() || b.character != character || filterChanged;
+	if(reinsert) {
+		_physicsWorld->removeRigidBody(body);
+		body->setCollisionShape(shape);
 	}
+	if(resetTransform) {
+		btTransform tr;
+		b.motionState->getWorldTransform(tr);
+		body->setWorldTransform(tr);
+		body->setInterpolationWorldTransform(tr);
+		b.controller.reset();
+	}
+	b.character = character;
+	setupBody(body, col);
+	if(reinsert)
+		_physicsWorld->addRigidBody(body, col.getLayer(), col.getMask());
+}
+
+void Physics::setupBody(btRigidBody* body, CollisionComponent& col)
+{
+	// no dynamics - the mass is used only to tell the characters
+	int flags = body->getCollisionFlags() & ~btCollisionObject::CF_KINEMATIC_OBJECT;
+	if(col.getMass() != 0)
+		flags |= btCollisionObject::CF_KINEMATIC_OBJECT;
+	body->setCollisionFlags(flags);
+	// the contacts of the sleeping objects are not detected
+	body->setActivationState(DISABLE_DEACTIVATION);
+}
+
+btRigidBody* Physics::getBodyByID(ID entityID)
+{
+	Binding* b = getBinding(entityID);
+	return b ? b->body : nullptr;
+}
+
+Physics::Binding* Physics::getBinding(ID entityID)
+{
+	if(entityID < _bindings.size() && _bindings[entityID].body)
+		return &_bindings[entityID];
 	return nullptr;
 }
 
-void Physics::registerCollisionCallback(std::function<void(ID, ID)> callback)
+void Physics::bindBody(ID entityID, btRigidBody* body, MyMotionState* motionState, bool character)
+{
+	if(entityID >= _bindings.size())
+		_bindings.resize(entityID+1);
+	body->setUserIndex(entityID);
+	Binding& b = _bindings[entityID];
+	b = Binding{};
+	b.body = body;
+	b.motionState = motionState;
+	b.character = character;
+}
+
+void Physics::unbindBody(ID entityID)
+{
+	Binding* b = getBinding(entityID);
+	if(!b)
+		return;
+	_physicsWorld->removeRigidBody(b->body);
+	// the shape stays in the cache
+	b->motionState->bc = nullptr;
+	b->motionState->cc = nullptr;
+	Binding pooled;
+	pooled.body = b->body;
+	pooled.motionState = b->motionState;
+	_bodyPool.push_back(pooled);
+	*b = Binding{};
+}
+
+void Physics::refreshComponentHandles()
+{
+	for(std::size_t id = 0; id < _bindings.size(); ++id) {
+		Binding& b = _bindings[id];
+		if(!b.body)
+			continue;
+		Entity* e = _world.getEntity(id);
+		b.motionState->bc = e ? e->getComponent<BodyComponent>() : nullptr;
+		b.motionState->cc = e ? e->getComponent<CollisionComponent>() : nullptr;
+	}
+}
+
+void Physics::registerContactCallback(std::function<void(const std::vector<Contact>&)> callback)
+{
+	_contactCallbacks.push_back(callback);
+}
+
+void Physics::setStepSize(float seconds)
+{
+	_stepSize = seconds;
+}
+
+float Physics::getStepSize() const
+{
+	return _stepSize;
+}
+
+void Physics::setMaxSteps(unsigned steps)
+{
+	_maxSteps = steps;
+}
+
+float Physics::getSimulatedTime() const
+{
+	return _simulatedTime;
+}
+
+bool Physics::getCharacterState(ID objID, CharacterController::State& state)
+{
+	Binding* b = getBinding(objID);
+	if(!b || !b->character)
+		return false;
+	state = b->controller.getState();
+	return true;
+}
+
+void Physics::resetCharacter(ID objID, const CharacterController::State& state)
+{
+	Binding* b = getBinding(objID);
+	Entity* e = _world.getEntity(objID);
+	if(!b || !b->character || !e)
+		return;
+	// called between the updates - the handles may be stale
+	b->motionState->bc = e->getComponent<BodyComponent>();
+	b->motionState->cc = e->getComponent<CollisionComponent>();
+	if(!b->motionState->bc || !b->motionState->cc)
+		return;
+	btTransform tr;
+	b->motionState->getWorldTransform(tr);
+	b->body->setWorldTransform(tr);
+	_physicsWorld->updateSingleAabb(b->body);
+	b->controller.setState(state);
+}
+
+void Physics::stepCharacter(ID objID, float timeDelta)
+{
+	Binding* b = getBinding(objID);
+	if(!b || !b->character || timeDelta <= 0)
+		return;
+	_updating = true;
+	unsigned steps = std::max(1.f, std::round(timeDelta/_stepSize));
+	for(unsigned i = 0; i < steps; ++i)
+		moveCharacter(*b, timeDelta/steps);
+	_updating = false;
+}
+
+Physics::Stats Physics::takeStats()
+{
+	Stats s = _stats;
+	_stats = Stats();
+	return s;
+}
+
+////////////////////////////////////////////////////////////
+
+// squared distance of segments p1-q1 and p2-q2 (Ericson, Real-Time Collision Detection, 5.1.9)
+static float segmentSegmentDistanceSQ(vec3f p1, vec3f q1, vec3f p2, vec3f q2)
+{
+	const float eps = 1e-6f;
+	vec3f d1 = q1 - p1, d2 = q2 - p2, r = p1 - p2;
+	float a = d1.dotProduct(d1), e = d2.dotProduct(d2), f = d2.dotProduct(r);
+	float s, t;
+	if(a <= eps && e <= eps)
+		return r.dotProduct(r);
+	if(a <= eps) {
+		s = 0;
+		t = core::clamp(f/e, 0.f, 1.f);
+	}
+	else {
+		float c = d1.dotProduct(r);
+		if(e <= eps) {
+			t = 0;
+			s = core::clamp(-c/a, 0.f, 1.f);
+		}
+		else {
+			float b = d1.dotProduct(d2);
+			float denom = a*e - b*b;
+			s = denom != 0 ? core::clamp((b*f - c*e)/denom, 0.f, 1.f) : 0;
+			t = (b*s + f)/e;
+			if(t < 0) {
+				t = 0;
+				s = core::clamp(-c/a, 0.f, 1.f);
+			}
+			else if(t > 1) {
+				t = 1;
+				s = core::clamp((b - c)/a, 0.f, 1.f);
+			}
+		}
+	}
+	vec3f c1 = p1 + d1*s, c2 = p2 + d2*t;
+	return (c1 - c2).dotProduct(c1 - c2);
+}
+
+ProjectileSystem::ProjectileSystem(World& world): System{world}, _grid{4}, _capsuleReach{0}, _updating{false}
+{}
+
+void ProjectileSystem::update(float timeDelta)
+{
+	// the contacts of the removed projectiles still end
+	if(_ids.empty() && _touching.empty())
+		return;
+	_updating = true;
+	// the component storage moves when components are added or removed (not during the update)
+	for(std::size_t i = 0; i < _ids.size(); ++i) {
+		Entity* e = _world.getEntity(_ids[i]);
+		_bodies[i] = e ? e->getComponent<BodyComponent>() : nullptr;
+	}
+
+	bool testContacts = !_contactCallbacks.empty();
+	if(testContacts) {
+		refreshDynamicColliders();
+		_touchingNow.clear();
+	}
+	std::size_t n = _ids.size();
+	if(testContacts)
+		_previousPositions.assign(_positions.begin(), _positions.end());
+	// the integration alone, the sweeps (branchy, the grid queries) are a separate pass
+	vec3f* pos = _positions.data();
+	const vec3f* vel = _velocities.data();
+	for(std::size_t i = 0; i < n; ++i)
+		pos[i] += vel[i]*timeDelta;
+	if(testContacts)
+		for(std::size_t i = 0; i < n; ++i)
+			sweep(i, _previousPositions[i], pos[i]);
+	for(std::size_t i = 0; i < n; ++i)
+		if(_bodies[i])
+			_bodies[i]->setPosition(pos[i]);
+	_updating = false;
+
+	// the callbacks may move or destroy the projectiles
+	if(testContacts) {
+		diffContacts(_touching, _touchingNow, _contacts);
+		if(!_contacts.empty())
+			for(auto& cb : _contactCallbacks)
+				cb(_contacts);
+	}
+}
+
+void ProjectileSystem::onMsg(const EntityEvent& m)
+{
+	if(_updating)
+		return;
+	if(m.componentT != ComponentType::Body && m.componentT != ComponentType::Collision)
+		return;
+	ID eID = m.entityID;
+	Entity* e;
+	BodyComponent* bc = nullptr;
+	CollisionComponent* cc = nullptr;
+	if(!m.destroyed && (e = _world.getEntity(eID))) {
+		bc = e->getComponent<BodyComponent>();
+		cc = e->getComponent<CollisionComponent>();
+	}
+	bool projectile = bc && cc && cc->isKinematic();
+	bool collider = bc && cc && !cc->isKinematic();
+
+	u32 slot = eID < _slots.size() ? _slots[eID] : 0;
+	if(projectile && slot) {
+		// moved or stopped from the outside (a script, the server)
+		std::size_t i = slot-1;
+		_positions[i] = bc->getPosition();
+		_velocities[i] = bc->getVelocity();
+		_radii[i] = cc->getRadius();
+		_layers[i] = cc->getLayer();
+		_masks[i] = cc->getMask();
+	}
+	else if(projectile)
+		add(eID, *bc, *cc);
+	else if(slot)
+		remove(eID);
+
+	if(collider)
+		setCollider(eID, *bc, *cc);
+	else if(eID < _colliderSlots.size() && _colliderSlots[eID])
+		removeCollider(eID);
+}
+
+void ProjectileSystem::registerContactCallback(std::function<void(const std::vector<Contact>&)> callback)
+{
+	_contactCallbacks.push_back(callback);
+}
+
+std::size_t ProjectileSystem::getProjectileC() const
+{
+	return _ids.size();
+}
+
+void ProjectileSystem::add(ID entityID, BodyComponent& bc, CollisionComponent& cc)
+{
+	if(entityID >= _slots.size())
+		_slots.resize(entityID+1, 0);
+	_ids.push_back(entityID);
+	_positions.push_back(bc.getPosition());
+	_velocities.push_back(bc.getVelocity());
+	_radii.push_back(cc.getRadius());
+	_layers.push_back(cc.getLayer());
+	_masks.push_back(cc.getMask());
+	_bodies.push_back(nullptr);
+	_slots[entityID] = _ids.size();
+}
+
+void ProjectileSystem::remove(ID entityID)
+{
+	std::size_t i = _slots[entityID]-1;
+	std::size_t last = _ids.size()-1;
+	_slots[_ids[last]] = i+1;
+	_slots[entityID] = 0;
+	_ids[i] = _ids[last];
+	_positions[i] = _positions[last];
+	_velocities[i] = _velocities[last];
+	_radii[i] = _radii[last];
+	_layers[i] = _layers[last];
+	_masks[i] = _masks[last];
+	_bodies[i] = _bodies[last];
+	_ids.pop_back();
+	_positions.pop_back();
+	_velocities.pop_back();
+	_radii.pop_back();
+	_layers.pop_back();
+	_masks.pop_back();
+	_bodies.pop_back();
+}
+
+void ProjectileSystem::setCollider(ID entityID, BodyComponent& bc, CollisionComponent& cc)
+{
+	if(entityID >= _colliderSlots.size())
+		_colliderSlots.resize(entityID+1, 0);
+	u32& slot = _colliderSlots[entityID];
+	bool dynamic = cc.getMass() != 0;
+	bool wasDynamic = slot && _capsules[slot-1].dynamic;
+	if(!slot) {
+		_capsules.push_back(Capsule());
+		slot = _capsules.size();
+	}
+	if(dynamic && !wasDynamic)
+		_dynamicColliders.push_back(entityID);
+	else if(!dynamic && wasDynamic)
+		_dynamicColliders.erase(std::find(_dynamicColliders.begin(), _dynamicColliders.end(), entityID));
+	// the same capsule as the Bullet body
+	vec3f center = bc.getPosition() - cc.getPosOffset();
+	vec3f half(0, cc.getHeight()/2, 0);
+	float r = cc.getRadius();
+	_capsules[slot-1] = Capsule{entityID, center - half, center + half, r, cc.getLayer(), cc.getMask(), dynamic};
+	_capsuleReach = std::max(_capsuleReach, half.Y + r);
+	_grid.set(entityID, center.X, center.Y, center.Z);
+}
+
+void ProjectileSystem::removeCollider(ID entityID)
+{
+	u32 slot = _colliderSlots[entityID];
+	if(_capsules[slot-1].dynamic)
+		// just the characters
+		_dynamicColliders.erase(std::find(_dynamicColliders.begin(), _dynamicColliders.end(), entityID));
+	_colliderSlots[_capsules.back().entity] = slot;
+	_colliderSlots[entityID] = 0;
+	_capsules[slot-1] = _capsules.back();
+	_capsules.pop_back();
+	_grid.remove(entityID);
+}
+
+// the characters move within the physics update - their events may come after this update (the server queues them)
+void ProjectileSystem::refreshDynamicColliders()
+{
+	for(ID id : _dynamicColliders) {
+		Entity* e = _world.getEntity(id);
+		BodyComponent* bc;
+		CollisionComponent* cc;
+		if(!e || !(bc = e->getComponent<BodyComponent>()) || !(cc = e->getComponent<CollisionComponent>()))
+			continue;
+		Capsule& c = _capsules[_colliderSlots[id]-1];
+		vec3f center = bc->getPosition() - cc->getPosOffset();
+		vec3f half = (c.b - c.a)/2;
+		c.a = center - half;
+		c.b = center + half;
+		_grid.set(id, center.X, center.Y, center.Z);
+	}
+}
+
+// minimum of the quadratic through f(0) = f0, f(0.5) = fm, f(1) = f1 on [0, 1]
+static float quadraticMin(float f0, float fm, float f1)
 {
-	_collCallbacks.push_back(callback);
-	_collCallbacks.push_back([callback](ID first, ID second) {
-				callback(second, first);
-			});
+	float a = 2*(f0 + f1) - 4*fm;
+	float b = 4*fm - 3*f0 - f1;
+	float m = std::min(f0, f1);
+	if(a > 0) {
+		float s = -b/(2*a);
+		if(s > 0 && s < 1)
+			m = std::min(m, f0 + b*s + a*s*s);
+	}
+	return m;
+}
+
+// whether the lowest point of the sphere gets under the surface on the way
+// the heightmap is bilinear within each of its cells, so along a straight path the clearance is a quadratic there -
+// the path is cut at the cell borders and the minimum of each piece is found exactly
+bool ProjectileSystem::sweepTerrain(const Terrain& terrain, vec3f from, vec3f to, float r)
+{
+	if(!std::isfinite(from.X) || !std::isfinite(from.Z) || !std::isfinite(to.X) || !std::isfinite(to.Z))
+		return false;
+	vec2u size = terrain.size();
+	vec3f d = to - from;
+	// the part of the path above the terrain
+	float t0 = 0, t1 = 1;
+	auto clip = [&](float p, float dp, float max) {
+		if(dp == 0)
+			return p >= 0 && p <= max;
+		float a = -p/dp, b = (max - p)/dp;
+		t0 = std::max(t0, std::min(a, b));
+		t1 = std::min(t1, std::max(a, b));
+		return t0 <= t1;
+	};
+	if(!clip(from.X, d.X, size.X-1) || !clip(from.Z, d.Z, size.Y-1))
+		return false;
+	_cuts.clear();
+	_cuts.push_back(t0);
+	_cuts.push_back(t1);
+	auto cut = [&](float p, float dp) {
+		if(dp == 0)
+			return;
+		float a = p + dp*t0, b = p + dp*t1;
+		for(float k = std::ceil(std::min(a, b)); k < std::max(a, b); ++k)
+			_cuts.push_back(core::clamp((k - p)/dp, t0, t1));
+	};
+	cut(from.X, d.X);
+	cut(from.Z, d.Z);
+	std::sort(_cuts.begin(), _cuts.end());
+	auto clearance = [&](float t) {
+		vec3f p = from + d*t;
+		return p.Y - r - terrain.heightAt(core::clamp(p.X, 0.f, size.X-1.f), core::clamp(p.Z, 0.f, size.Y-1.f));
+	};
+	for(std::size_t i = 0; i+1 < _cuts.size(); ++i) {
+		float a = _cuts[i], b = _cuts[i+1];
+		if(quadraticMin(clearance(a), clearance((a + b)/2), clearance(b)) < 0)
+			return true;
+	}
+	return false;
 }
 
-void Physics::registerPairCollisionCallback(std::function<void(ID, ID)> callback)
+void ProjectileSystem::sweep(std::size_t i, vec3f from, vec3f to)
 {
-	_collCallbacks.push_back(callback);
+	ID id = _ids[i];
+	float r = _radii[i];
+	u16 layer = _layers[i];
+	u16 mask = _masks[i];
+
+	// the terrain and the border
+	if(mask & CollisionLayer::Terrain) {
+		const WorldMap& map = _world.getMap();
+		vec2u size = map.getSize();
+		// the inside of the border is convex, the path leaves it only if one of its ends does
+		auto outside = [&](vec3f p) {
+			return p.X - r < MAP_BORDER_PADDING || p.Z - r < MAP_BORDER_PADDING ||
+				p.X + r > size.X - 1 - MAP_BORDER_PADDING || p.Z + r > size.Y - 1 - MAP_BORDER_PADDING;
+		};
+		if(outside(from) || outside(to))
+			_touchingNow.push_back(std::minmax(id, NULLID));
+		if(sweepTerrain(map.getTerrain(), from, to, r))
+			_touchingNow.push_back(std::minmax(id, ID(ObjStaticID::Map)));
+	}
+
+	// the capsules near the path - a capsule touching it has its center within the reach of the middle of the path
+	vec3f middle = (from + to)/2;
+	float reach = from.getDistanceFrom(to)/2 + r + _capsuleReach;
+	_grid.queryRadius(middle.X, middle.Y, middle.Z, reach,
+		[&](ID colliderID, float) {
+			const Capsule& c = _capsules[_colliderSlots[colliderID]-1];
+			if(!(c.layer & mask) || !(layer & c.mask))
+				return;
+			float d = r + c.radius;
+			if(segmentSegmentDistanceSQ(from, to, c.a, c.b) <= d*d)
+				_touchingNow.push_back(std::minmax(id, c.entity));
+		});
 }
 		
 ////////////////////////////////////////////////////////////
 
-ViewSystem::ViewSystem(irr::scene::ISceneManager* smgr, World& world): System{world}, _smgr{smgr}
+ViewSystem::ViewSystem(irr::scene::ISceneManager* smgr, World& world): System{world}, _smgr{smgr}, _renderTime{0}
 {
 	smgr->addSkyDomeSceneNode(smgr->getVideoDriver()->getTexture("media/skydome.jpg"), 16,8,0.95f,2.0f,1000, nullptr, ObjStaticID::Skybox);
 	loadTerrain();
@@ -469,6 +967,17 @@ ViewSystem::~ViewSystem()
 
 void ViewSystem::onMsg(const EntityEvent& m)
 {
+	if(m.destroyed && (m.componentT == ComponentType::Body || m.componentT == ComponentType::NONE))
+		_networkSamples.erase(m.entityID);
+	if(m.componentT == ComponentType::Collision && !m.destroyed) {
+		// kinematic bodies are moved by the local physics (dead reckoning), not interpolated
+		Entity* e = _world.getEntity(m.entityID);
+		CollisionComponent* cc;
+		if(e && (cc = e->getComponent<CollisionComponent>()) && cc->isKinematic()) {
+			_networkSamples.erase(m.entityID);
+			_transformedEntities.insert(m.entityID);
+		}
+	}
 	if(m.componentT == ComponentType::Body) {
 		scene::ISceneNode* sn = _smgr->getSceneNodeFromId(m.entityID);
 		if(sn && m.destroyed)
@@ -646,15 +1155,45 @@ bool ViewSystem::isSceneNodeVisible(scene::IMeshSceneNode* sn)
 	return r>0;
 }
 
+void ViewSystem::addNetworkSample(ID entityID, float serverTime, const BodyComponent& bc)
+{
+	_networkSamples[entityID].push(serverTime, BodyState{bc.getPosition(), bc.getRotation()});
+}
+
+void ViewSystem::setRenderTime(float serverTime)
+{
+	_renderTime = serverTime;
+}
+
 void ViewSystem::updateTransforms(float timeDelta)
 {
+	// entities with server samples are rendered in the past (render time) between two real states
+	static const float maxExtrapolation = 0.25;
+	static const auto interpolateBodyState = [](const BodyState& a, const BodyState& b, float f) {
+		BodyState r;
+		r.position = a.position + (b.position-a.position)*f;
+		r.rotation.slerp(a.rotation, b.rotation, std::min(f, 1.f));
+		return r;
+	};
+	for(auto& s : _networkSamples) {
+		scene::ISceneNode* sn = _smgr->getSceneNodeFromId(s.first);
+		BodyState state;
+		if(!sn || !s.second.sample(_renderTime, state, maxExtrapolation, interpolateBodyState))
+			continue;
+		vec3f r;
+		state.rotation.toEuler(r);
+		sn->setRotation(r*180/PI);
+		sn->setPosition(state.position);
+		sn->updateAbsolutePosition();
+	}
+
 	//TODO remove the list?
 	for(auto it = _transformedEntities.begin(); it != _transformedEntities.end(); ) {
 		auto eID = *it;
 		Entity* e;
 		BodyComponent* bc;
 		scene::ISceneNode* sn;
-		if((e = _world.getEntity(eID)) && (bc = e->getComponent<BodyComponent>()) && (sn = _smgr->getSceneNodeFromId(eID)))
+		if(_networkSamples.count(eID) == 0 && (e = _world.getEntity(eID)) && (bc = e->getComponent<BodyComponent>()) && (sn = _smgr->getSceneNodeFromId(eID)))
 		{
 			quaternion newRot = bc->getRotation();
 			static const float rotationInterpolationSpeed = 4;
@@ -812,7 +1351,225 @@ void ViewSystem::loadTerrain()
 
 ////////////////////////////////////////////////////////////
 
-SpellSystem::SpellSystem(World& world): System{world}, _luaState{nullptr}
+SpatialIndex::SpatialIndex(World& world, float cellSize): System{world}, _grid{cellSize}
+{}
+
+void SpatialIndex::onMsg(const EntityEvent& m)
+{
+	if(m.componentT != ComponentType::Body && !(m.componentT == ComponentType::NONE && m.destroyed))
+		return;
+	Entity* e;
+	BodyComponent* bc;
+	if(!m.destroyed && (e = _world.getEntity(m.entityID)) && (bc = e->getComponent<BodyComponent>())) {
+		vec3f p = bc->getPosition();
+		_grid.set(m.entityID, p.X, p.Y, p.Z);
+	}
+	else
+		_grid.remove(m.entityID);
+}
+
+std::vector<ID> SpatialIndex::getEntitiesInRadius(vec3f center, float radius, u32 componentMask)
+{
+	std::vector<ID> r;
+	_grid.queryRadius(center.X, center.Y, center.Z, radius, [&](ID id, float) {
+			if(hasComponents(id, componentMask))
+				r.push_back(id);
+		});
+	return r;
+}
+
+std::vector<ID> SpatialIndex::getNearestEntities(vec3f center, std::size_t k, u32 componentMask)
+{
+	std::vector<ID> r;
+	_grid.nearest(center.X, center.Y, center.Z, k, [&](ID id) { return hasComponents(id, componentMask); }, r);
+	return r;
+}
+
+bool SpatialIndex::hasComponents(ID entityID, u32 componentMask)
+{
+	if(componentMask == 0)
+		return true;
+	Entity* e = _world.getEntity(entityID);
+	if(!e)
+		return false;
+	for(u8 t = ComponentType::NONE+1; t < ComponentType::LAST; ++t)
+		if((componentMask & (1 << t)) && !e->hasComponent(ComponentType(t)))
+			return false;
+	return true;
+}
+
+static void pushIDs(lua_State* s, const std::vector<ID>& ids)
+{
+	lua_createtable(s, ids.size(), 0);
+	for(std::size_t i = 0; i < ids.size(); ++i) {
+		lua_pushinteger(s, ids[i]);
+		lua_rawseti(s, -2, i+1);
+	}
+}
+
+void registerSpatialQueryAPI(lua_State* L, SpatialIndex& index)
+{
+	auto getEntitiesInRadius = [](lua_State* s)->int {
+		int argc = lua_gettop(s);
+		if(argc != 4 && argc != 5)
+		{
+			std::cerr << "getEntitiesInRadius: wrong number of arguments\n";
+			return 0;
+		}
+		SpatialIndex* index = (SpatialIndex*)lua_touserdata(s, lua_upvalueindex(1));
+		vec3f center(lua_tonumber(s, 1), lua_tonumber(s, 2), lua_tonumber(s, 3));
+		float radius = lua_tonumber(s, 4);
+		luaL_argcheck(s, std::isfinite(center.X) && std::isfinite(center.Y) && std::isfinite(center.Z), 1, "the center is not finite");
+		luaL_argcheck(s, std::isfinite(radius) && radius >= 0, 4, "the radius must be finite and not negative");
+		u32 componentMask = argc == 5 ? lua_tointeger(s, 5) : 0;
+		pushIDs(s, index->getEntitiesInRadius(center, radius, componentMask));
+		return 1;
+	};
+	lua_pushlightuserdata(L, &index);
+	lua_pushcclosure(L, getEntitiesInRadius, 1);
+	lua_setglobal(L, "getEntitiesInRadius");
+
+	auto getNearestEntities = [](lua_State* s)->int {
+		int argc = lua_gettop(s);
+		if(argc != 4 && argc != 5)
+		{
+			std::cerr << "getNearestEntities: wrong number of arguments\n";
+			return 0;
+		}
+		SpatialIndex* index = (SpatialIndex*)lua_touserdata(s, lua_upvalueindex(1));
+		vec3f center(lua_tonumber(s, 1), lua_tonumber(s, 2), lua_tonumber(s, 3));
+		luaL_argcheck(s, std::isfinite(center.X) && std::isfinite(center.Y) && std::isfinite(center.Z), 1, "the center is not finite");
+		lua_Integer k = lua_tointeger(s, 4);
+		u32 componentMask = argc == 5 ? lua_tointeger(s, 5) : 0;
+		pushIDs(s, index->getNearestEntities(center, std::max<lua_Integer>(k, 0), componentMask));
+		return 1;
+	};
+	lua_pushlightuserdata(L, &index);
+	lua_pushcclosure(L, getNearestEntities, 1);
+	lua_setglobal(L, "getNearestEntities");
+}
+
+////////////////////////////////////////////////////////////
+
+AttributeIndex::AttributeIndex(World& world): System{world}
+{}
+
+void AttributeIndex::onMsg(const EntityEvent& m)
+{
+	if(m.componentT != ComponentType::AttributeStore && !(m.componentT == ComponentType::NONE && m.destroyed))
+		return;
+	ID eID = m.entityID;
+	Attributes now;
+	Entity* e;
+	AttributeStoreComponent* asc = nullptr;
+	if(!m.destroyed && (e = _world.getEntity(eID)))
+		asc = e->getComponent<AttributeStoreComponent>();
+	const std::string* key;
+	if(asc && !m.created && eID < _indexed.size() && (key = asc->getChangedAttribute())) {
+		update(eID, *key, *asc);
+		return;
+	}
+	if(asc)
+		asc->forEachAttribute(
+			[&now](const std::string& key, float value) { now[key] = Value{true, value}; },
+			[&now](const std::string& key, const std::string&) { now[key] = Value{false, 0}; });
+	if(eID >= _indexed.size()) {
+		if(now.empty())
+			return;
+		_indexed.resize(eID+1);
+	}
+
+	// both are sorted by the key
+	Attributes& last = _indexed[eID];
+	auto l = last.begin();
+	auto n = now.begin();
+	while(l != last.end() || n != now.end()) {
+		if(n == now.end() || (l != last.end() && l->first < n->first)) {
+			remove(eID, l->first, l->second);
+			++l;
+		}
+		else if(l == last.end() || n->first < l->first) {
+			add(eID, n->first, n->second);
+			++n;
+		}
+		else {
+			if(!(l->second == n->second)) {
+				remove(eID, l->first, l->second);
+				add(eID, n->first, n->second);
+			}
+			++l;
+			++n;
+		}
+	}
+	last.swap(now);
+}
+
+const std::set<ID>& AttributeIndex::getEntities(const std::string& key) const
+{
+	auto e = _entries.find(key);
+	return e != _entries.end() ? e->second.all : _none;
+}
+
+const std::set<ID>& AttributeIndex::getEntities(const std::string& key, float value) const
+{
+	auto e = _entries.find(key);
+	if(e == _entries.end())
+		return _none;
+	auto v = e->second.byValue.find(value);
+	return v != e->second.byValue.end() ? v->second : _none;
+}
+
+void AttributeIndex::add(ID entityID, const std::string& key, const Value& v)
+{
+	Entry& e = _entries[key];
+	e.all.insert(entityID);
+	if(v.isIndexedByValue())
+		e.byValue[v.value].insert(entityID);
+}
+
+void AttributeIndex::update(ID entityID, const std::string& key, AttributeStoreComponent& asc)
+{
+	Attributes& indexed = _indexed[entityID];
+	auto i = indexed.find(key);
+	bool present = asc.hasAttribute(key);
+	// a string wins over a float of the same key (as in forEachAttribute)
+	Value now = present && !asc.isStringAttribute(key) ? Value{true, asc.getAttribute<float>(key)} : Value{false, 0};
+	if(i != indexed.end()) {
+		if(present && i->second == now)
+			return;
+		remove(entityID, key, i->second);
+		if(!present) {
+			indexed.erase(i);
+			return;
+		}
+		i->second = now;
+	}
+	else if(present)
+		indexed.emplace(key, now);
+	else
+		return;
+	add(entityID, key, now);
+}
+
+void AttributeIndex::remove(ID entityID, const std::string& key, const Value& v)
+{
+	Entry& e = _entries[key];
+	e.all.erase(entityID);
+	if(v.isIndexedByValue()) {
+		auto b = e.byValue.find(v.value);
+		if(b == e.byValue.end())
+			return;
+		b->second.erase(entityID);
+		if(b->second.empty())
+			e.byValue.erase(b);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+SpellSystem::SpellSystem(World& world, SpatialIndex* index): System{world}, _luaState{nullptr}, _spatialIndex{index}, _contactStateMask{0},
+	_lAddWizard{"addWizard"}, _lRemoveWizard{"removeWizard"}, _lHandleIncantation{"handleIncantation"}, _lHandleLaunch{"handleLaunch"},
+	_lDefineIncantation{"defineIncantation"}, _lHandleContacts{"handleContacts"}, _lUpdate{"update"}, _lWizardWalking{"wizardWalking"}
 {
 	init();
 }
@@ -857,91 +1614,134 @@ void SpellSystem::reload()
 
 void SpellSystem::addWizard(ID entID)
 {
-	if(_luaState != nullptr)
-	{
-		lua_getglobal(_luaState, "addWizard");
-		lua_pushinteger(_luaState, entID);
-		if(lua_pcall(_luaState, 1, 0, 0) != 0)
-		{
-			cerr << "something went wrong with addWizard: " << lua_tostring(_luaState, -1) << endl;
-			lua_pop(_luaState, 1);
-		}
-	}
+	_lAddWizard(entID);
 }
 
 void SpellSystem::removeWizard(ID entID)
 {
-	if(_luaState != nullptr)
-	{
-		lua_getglobal(_luaState, "removeWizard");
-		lua_pushinteger(_luaState, entID);
-		if(lua_pcall(_luaState, 1, 0, 0) != 0)
-		{
-			cerr << "something went wrong with removeWizard: " << lua_tostring(_luaState, -1) << endl;
-			lua_pop(_luaState, 1);
-		}
-	}
+	_lRemoveWizard(entID);
 }
 
-void SpellSystem::cast(std::string& incantation, ID authorID)
+// the script's parseIncantation looks for a command (spell_...) anywhere in the incantation
+static bool hasIncantationCommand(const std::string& incantation)
 {
-	lua_getglobal(_luaState, "handleIncantation");
-	lua_pushinteger(_luaState, authorID);
-	lua_pushstring(_luaState, incantation.c_str());
-	if(lua_pcall(_luaState, 2, 0, 0) != 0)
-	{
-		cerr << "something went wrong with handleIncantation: " << lua_tostring(_luaState, -1) << endl;
-		lua_pop(_luaState, 1);
-	}
+	const std::string prefix = "spell_";
+	for(std::size_t i = incantation.find(prefix); i != std::string::npos; i = incantation.find(prefix, i+1))
+		if(i + prefix.size() < incantation.size() && !std::isspace((unsigned char)incantation[i + prefix.size()]))
+			return true;
+	return false;
 }
 
-void SpellSystem::collisionCallback(ID objID, ID otherObjID)
+u32 SpellSystem::defineIncantation(const std::string& incantation, bool limited)
 {
-	lua_getglobal(_luaState, "handleCollision");
-	lua_pushinteger(_luaState, objID);
-	lua_pushinteger(_luaState, otherObjID);
-	if(lua_pcall(_luaState, 2, 0, 0) != 0)
-	{
-		cerr << "something went wrong with handleCollision: " << lua_tostring(_luaState, -1) << endl;
-		lua_pop(_luaState, 1);
-	}
+	auto i = _incantationIDs.find(incantation);
+	if(i != _incantationIDs.end())
+		return i->second;
+	if(limited && (incantation.size() > MAX_INCANTATION_LENGTH || _incantationIDs.size() >= MAX_INCANTATIONS))
+		return NO_INCANTATION;
+	if(!hasIncantationCommand(incantation))
+		return NO_INCANTATION;
+	u32 id = _incantationIDs.size();
+	_incantationIDs[incantation] = id;
+	lDefineIncantation(id, incantation);
+	return id;
+}
+
+u32 SpellSystem::findIncantation(const std::string& incantation) const
+{
+	auto i = _incantationIDs.find(incantation);
+	return i == _incantationIDs.end() ? NO_INCANTATION : i->second;
+}
+
+void SpellSystem::cast(u32 incantation, ID authorID)
+{
+	_lHandleIncantation(authorID, incantation);
+}
+
+void SpellSystem::launch(float elevation, ID authorID)
+{
+	_lHandleLaunch(authorID, elevation);
+}
+
+void SpellSystem::lDefineIncantation(u32 id, const std::string& incantation)
+{
+	_lDefineIncantation(id, incantation);
+}
+
+void SpellSystem::contactCallback(const std::vector<Contact>& contacts)
+{
+	auto subscribed = [this](const Contact& c) { return _contactStateMask & (1 << u8(c.state)); };
+	std::size_t count = std::count_if(contacts.begin(), contacts.end(), subscribed);
+	if(count == 0)
+		return;
+	// flat array {first1, second1, state1, first2, ...}
+	_lHandleContacts([&](lua_State* L) {
+			lua_createtable(L, count*3, 0);
+			lua_Integer i = 0;
+			for(const Contact& c : contacts) {
+				if(!subscribed(c))
+					continue;
+				lua_pushinteger(L, c.first);
+				lua_rawseti(L, -2, ++i);
+				lua_pushinteger(L, c.second);
+				lua_rawseti(L, -2, ++i);
+				lua_pushinteger(L, u8(c.state));
+				lua_rawseti(L, -2, ++i);
+			}
+		});
+}
+
+u32 SpellSystem::takeScriptFailureC()
+{
+	u32 c = 0;
+	for(LuaFunction* f : scriptFunctions())
+		c += f->takeFailureC();
+	return c;
 }
 
 void SpellSystem::lUpdate(float timeDelta)
 {
-	if(_luaState != nullptr)
-	{
-		lua_getglobal(_luaState, "update");
-		lua_pushnumber(_luaState, timeDelta);
-		if(lua_pcall(_luaState, 1, 0, 0) != 0)
-		{
-			cerr << "something went wrong with spell update: " << lua_tostring(_luaState, -1) << endl;
-			lua_pop(_luaState, 1);
-		}
-	}
+	_lUpdate(timeDelta);
 }
 
 void SpellSystem::lReportWalkingWizard(ID wizID, bool walking)
 {
-	if(_luaState != nullptr)
-	{
-		lua_getglobal(_luaState, "wizardWalking");
-		lua_pushinteger(_luaState, wizID);
-		lua_pushboolean(_luaState, walking);
-		if(lua_pcall(_luaState, 2, 0, 0) != 0)
-		{
-			cerr << "something went wrong with wizardWalking: " << lua_tostring(_luaState, -1) << endl;
-			lua_pop(_luaState, 1);
-		}
-	}
+	_lWizardWalking(wizID, walking);
+}
+
+std::vector<LuaFunction*> SpellSystem::scriptFunctions()
+{
+	return {&_lAddWizard, &_lRemoveWizard, &_lHandleIncantation, &_lHandleLaunch, &_lDefineIncantation,
+		&_lHandleContacts, &_lUpdate, &_lWizardWalking};
 }
 
 void SpellSystem::init()
 {
 	_luaState = luaL_newstate();
 	luaL_openlibs(_luaState);
+	registerCollisionFilterAPI(_luaState, _world);
+	if(_spatialIndex)
+		registerSpatialQueryAPI(_luaState, *_spatialIndex);
 	luaL_dofile(_luaState, "lua/spellSystem.lua");
 
+	// CONTACT_STATES = {"begin", "persist", "end"} - the states the script wants, all by default
+	_contactStateMask = 0;
+	if(lua_getglobal(_luaState, "CONTACT_STATES") == LUA_TTABLE) {
+		for(auto& s : lua_loadTable(_luaState, -1)) {
+			if(s.second == "begin")
+				_contactStateMask |= 1 << u8(ContactState::Begin);
+			else if(s.second == "persist")
+				_contactStateMask |= 1 << u8(ContactState::Persist);
+			else if(s.second == "end")
+				_contactStateMask |= 1 << u8(ContactState::End);
+			else
+				cerr << "unknown contact state in CONTACT_STATES: " << s.second << endl;
+		}
+	}
+	else
+		_contactStateMask = 0xFF;
+	lua_pop(_luaState, 1);
+
 	auto callLaunchSpell = [](lua_State* s)->int {
 		int argc = lua_gettop(s);
 		if(argc != 5)
@@ -1093,11 +1893,20 @@ void SpellSystem::init()
 	lua_pushlightuserdata(_luaState, &_world);
 	lua_pushcclosure(_luaState, entityInGround, 1);
 	lua_setglobal(_luaState, "entityInGround");
+
+	// looked up once per load of the script
+	for(LuaFunction* f : scriptFunctions())
+		f->resolve(_luaState);
+	for(auto& i : _incantationIDs)
+		lDefineIncantation(i.second, i.first);
 }
 
 void SpellSystem::deinit()
 {
+	for(LuaFunction* f : scriptFunctions())
+		f->release();
 	lua_close(_luaState);
+	_luaState = nullptr;
 }
 
 ID SpellSystem::launchSpell(float radius, float speed, float elevation, ID wizard, ID spellEffectID)
@@ -1116,7 +1925,7 @@ ID SpellSystem::launchSpell(float radius, float speed, float elevation, ID wizar
 	dir.rotateXZBy(-90);
 	vec3f pos = wBody->getPosition() + vec3f(0,1.5,0) + dir*(radius + 0.6 + abs(dir.Y));
 	spellE.addComponent<BodyComponent>(pos, quaternion(), dir*speed);
-	spellE.addComponent<CollisionComponent>(radius, 0, vec3f(0), 1, true, 0);
+	spellE.addComponent<CollisionComponent>(radius, 0, vec3f(0), 1, true, 0, CollisionLayer::Spell, CollisionLayer::SpellMask);
 #ifdef DEBUG_BUILD
 	spellE.addComponent<SphereGraphicsComponent>(radius);
 #endif
@@ -1148,6 +1957,41 @@ ID SpellSystem::addAttributeAffectorTo(ID eID, ID authorID, std::string attribut
 
 ////////////////////////////////////////////////////////////
 
+void registerCollisionFilterAPI(lua_State* L, World& world)
+{
+	lua_newtable(L);
+	lua_pushliteral(L, "Default"); lua_pushinteger(L, CollisionLayer::Default); lua_settable(L, -3);
+	lua_pushliteral(L, "Terrain"); lua_pushinteger(L, CollisionLayer::Terrain); lua_settable(L, -3);
+	lua_pushliteral(L, "Character"); lua_pushinteger(L, CollisionLayer::Character); lua_settable(L, -3);
+	lua_pushliteral(L, "Spell"); lua_pushinteger(L, CollisionLayer::Spell); lua_settable(L, -3);
+	lua_pushliteral(L, "Tree"); lua_pushinteger(L, CollisionLayer::Tree); lua_settable(L, -3);
+	lua_pushliteral(L, "All"); lua_pushinteger(L, CollisionLayer::All); lua_settable(L, -3);
+	lua_setglobal(L, "CollisionLayer");
+
+	auto setEntityCollisionFilter = [](lua_State* s)->int {
+		int argc = lua_gettop(s);
+		if(argc != 3)
+		{
+			std::cerr << "setEntityCollisionFilter: wrong number of arguments\n";
+			return 0;
+		}
+		World* world = (World*)lua_touserdata(s, lua_upvalueindex(1));
+		ID entityID = lua_tointeger(s, 1);
+		u16 layer = lua_tointeger(s, 2);
+		u16 mask = lua_tointeger(s, 3);
+		Entity* e = world->getEntity(entityID);
+		CollisionComponent* cc;
+		if(e && (cc = e->getComponent<CollisionComponent>()))
+			cc->setFilter(layer, mask);
+		return 0;
+	};
+	lua_pushlightuserdata(L, &world);
+	lua_pushcclosure(L, setEntityCollisionFilter, 1);
+	lua_setglobal(L, "setEntityCollisionFilter");
+}
+
+////////////////////////////////////////////////////////////
+
 InputSystem::InputSystem(World& world, SpellSystem& spells): System{world}, _spells{spells}
 {
 }
@@ -1157,10 +2001,11 @@ void InputSystem::handleCommand(Command& c, ID controlledObjID)
 	switch(c._type)
 	{
 		case Command::Type::STRAFE_DIR_SET:
+		case Command::Type::Y_ANGLE_SET:
 			{
 				auto bc = getBodyComponent(controlledObjID);
 				if(bc)
-					bc->setStrafeDir(c._vec2f);
+					applyMovementCommand(c, *bc);
 				break;
 			}
 		case Command::Type::ROT_DIR_SET:
@@ -1170,35 +2015,43 @@ void InputSystem::handleCommand(Command& c, ID controlledObjID)
 					;//bc->setRotDir(c._i32);
 				break;
 			}
-		case Command::Type::STR:
+		case Command::Type::CAST:
+			_spells.cast(c._u32, controlledObjID);
+			break;
+		case Command::Type::LAUNCH_SPELL:
+			_spells.launch(c._float, controlledObjID);
+			break;
+		case Command::Type::SET_NAME:
 			{
-				if(c._str.find("spell_") == 0)
-				{
-					_spells.cast(c._str, controlledObjID);
-				}
-				if(c._str.find("NAME") == 0)
-				{
-					Entity* e = _world.getEntity(controlledObjID);
-					AttributeStoreComponent* as = nullptr;
-					if(e && (as = e->getComponent<AttributeStoreComponent>()))
-						as->setAttribute("name", c._str.substr(strlen("name ")));
-				}
+				Entity* e = _world.getEntity(controlledObjID);
+				AttributeStoreComponent* as = nullptr;
+				if(e && (as = e->getComponent<AttributeStoreComponent>()))
+					as->setAttribute("name", c._str);
 				break;
 			}
+		default:
+			cerr << "unknown command type to handle: " << c._type << "\n";
+	}
+}
+
+bool InputSystem::applyMovementCommand(const Command& c, BodyComponent& bc)
+{
+	switch(c._type)
+	{
+		case Command::Type::STRAFE_DIR_SET:
+			bc.setStrafeDir(c._vec2f);
+			return true;
 		case Command::Type::Y_ANGLE_SET:
 			{
-				auto bc = getBodyComponent(controlledObjID);
-				if(bc) {
-					quaternion q = bc->getRotation();
-					vec3f e;
-					q.toEuler(e);
-					q = /*quaternion(e.X,0,e.Z)*/quaternion(0,c._float,0); // TODO retain previous X and Z rotation
-					bc->setRotation(q);
-				}
-				break;
+				quaternion q = bc.getRotation();
+				vec3f e;
+				q.toEuler(e);
+				q = /*quaternion(e.X,0,e.Z)*/quaternion(0,c._float,0); // TODO retain previous X and Z rotation
+				bc.setRotation(q);
+				return true;
 			}
 		default:
-			cerr << "unknown command type to handle: " << c._type << "\n";
+			return false;
 	}
 }
 
@@ -28,7 +28,7 @@ void Terrain::setSeed(unsigned seed)
 	init();
 }
 
-unsigned Terrain::getSeed()
+unsigned Terrain::getSeed() const
 {
 	return _seed;
 }
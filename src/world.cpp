@@ -1,4 +1,5 @@
 #include <world.hpp>
+#include <serdes.hpp>
 #include <cassert>
 
 ObservableComponentBase::ObservableComponentBase(ID parentEntID, ComponentType realCompType)
@@ -12,6 +13,11 @@ void ObservableComponentBase::notifyObservers()
 	broadcastMsg(_updMsg);
 }
 
+ComponentType ObservableComponentBase::getComponentType() const
+{
+	return _updMsg.componentT;
+}
+
 ////////////////////////////////////////////////////////////
 
 BodyComponent::BodyComponent(ID parentEntID, vec3f position, quaternion rotation, vec3f velocity)
@@ -89,11 +95,6 @@ float BodyComponent::getStrafeSpeed() const
 	return _strafeSpeed;
 }
 
-void BodyComponent::serDes(SerDesBase& s)
-{
-	s.serDes(*this);
-}
-
 ////////////////////////////////////////////////////////////
 
 GraphicsComponent::GraphicsComponent(ID parentEntID, ComponentType t
@@ -141,11 +142,6 @@ void GraphicsComponent::setScale(vec3f s)
 	notifyObservers();
 }
 
-void GraphicsComponent::serDes(SerDesBase& s)
-{
-	s.serDes(*this);
-}
-
 // // // // // // // // // // // // // // // // // // // //
 
 SphereGraphicsComponent::SphereGraphicsComponent(ID parentEntID, float radius, vec3f posOffset, vec3f rotOffset, vec3f scale)
@@ -165,24 +161,12 @@ void SphereGraphicsComponent::setRadius(float radius)
 	notifyObservers();
 }
 
-void SphereGraphicsComponent::serDes(SerDesBase& s)
-{
-	s.serDes(*static_cast<GraphicsComponent*>(this));
-	s.serDes(*this);
-}
-
 // // // // // // // // // // // // // // // // // // // //
 
 MeshGraphicsComponent::MeshGraphicsComponent(ID parentEntID, string fileName, bool animated, vec3f posOffset, vec3f rotOffset, vec3f scale)
 	: GraphicsComponent{parentEntID, ComponentType::GraphicsMesh, posOffset, rotOffset, scale}, _fileName{fileName}, _animated{animated}
 {}
 
-void MeshGraphicsComponent::serDes(SerDesBase& s)
-{
-	s.serDes(*static_cast<GraphicsComponent*>(this));
-	s.serDes(*this);
-}
-
 string MeshGraphicsComponent::getFileName()
 {
 	return _fileName;
@@ -199,12 +183,6 @@ ParticleSystemGraphicsComponent::ParticleSystemGraphicsComponent(ID parentEntID,
 	: GraphicsComponent{parentEntID, ComponentType::GraphicsParticleSystem, posOffset, rotOffset, scale}, _effectID{effectID}
 {}
 
-void ParticleSystemGraphicsComponent::serDes(SerDesBase& s)
-{
-	s.serDes(*static_cast<GraphicsComponent*>(this));
-	s.serDes(*this);
-}
-
 ID ParticleSystemGraphicsComponent::getEffectID()
 {
 	return _effectID;
@@ -213,10 +191,11 @@ ID ParticleSystemGraphicsComponent::getEffectID()
 ////////////////////////////////////////////////////////////
 
 CollisionComponent::CollisionComponent(ID parentEntID, float radius,
-	 	float height, vec3f posOffset, float mass, bool kinematic, float gravity)
+	 	float height, vec3f posOffset, float mass, bool kinematic, float gravity, u16 layer, u16 mask)
 	: ObservableComponentBase(parentEntID, ComponentType::Collision)
 		, _radius{radius}, _height{height}, _posOff{posOffset}
 		, _mass{mass}, _kinematic{kinematic}, _gravity{gravity}, _slippery{false}
+		, _layer{layer}, _mask{mask}
 {}
 
 float CollisionComponent::getRadius() const
@@ -249,11 +228,6 @@ void CollisionComponent::setPosOffset(vec3f pO)
 	_posOff = pO;
 }
 
-void CollisionComponent::serDes(SerDesBase& s)
-{
-	s.serDes(*this);
-}
-
 bool CollisionComponent::isKinematic()
 {
 	return _kinematic;
@@ -279,16 +253,28 @@ bool CollisionComponent::isSlippery()
 	return _slippery;
 }
 
-////////////////////////////////////////////////////////////
+u16 CollisionComponent::getLayer() const
+{
+	return _layer;
+}
 
-WizardComponent::WizardComponent(ID parentEntID):
- 	ObservableComponentBase(parentEntID, ComponentType::Wizard), _availableBodyC{0}, _totalBodyC{0}
+u16 CollisionComponent::getMask() const
 {
+	return _mask;
 }
 
-void WizardComponent::serDes(SerDesBase& s)
+void CollisionComponent::setFilter(u16 layer, u16 mask)
+{
+	_layer = layer;
+	_mask = mask;
+	notifyObservers();
+}
+
+////////////////////////////////////////////////////////////
+
+WizardComponent::WizardComponent(ID parentEntID):
+ 	ObservableComponentBase(parentEntID, ComponentType::Wizard), _availableBodyC{0}, _totalBodyC{0}
 {
-	s.serDes(*this);
 }
 
 void WizardComponent::setCurrentJobStatus(std::string job, int jobEffectId, float duration, float progress)
@@ -420,19 +406,20 @@ ID AttributeAffector::getAuthor() {
 
 // // // // // // // // // // // // // // // // // // // // 
 
-AttributeStoreComponent::AttributeStoreComponent(ID parentEntID): ObservableComponentBase(parentEntID, ComponentType::AttributeStore), _attributeAffectorHistory{10}
+AttributeStoreComponent::AttributeStoreComponent(ID parentEntID): ObservableComponentBase(parentEntID, ComponentType::AttributeStore), _attributeAffectorHistory{10},
+	_changedAttribute{nullptr}
 {}
 
 void AttributeStoreComponent::addAttribute(std::string key, float value)
 {
 	addPair(key, value);
-	notifyObservers();
+	notifyAttributeChanged(key);
 }
 
 void AttributeStoreComponent::addAttribute(std::string key, std::string value)
 {
 	addPair(key, value);
-	notifyObservers();
+	notifyAttributeChanged(key);
 }
 
 bool AttributeStoreComponent::hasAttribute(std::string key)
@@ -440,16 +427,33 @@ bool AttributeStoreComponent::hasAttribute(std::string key)
 	return hasKey(key);
 }
 
+bool AttributeStoreComponent::isStringAttribute(const std::string& key) const
+{
+	return isString(key);
+}
+
+const std::string* AttributeStoreComponent::getChangedAttribute() const
+{
+	return _changedAttribute;
+}
+
 void AttributeStoreComponent::setAttribute(std::string key, float value)
 {
 	setValue(key, value);
-	notifyObservers();
+	notifyAttributeChanged(key);
 }
 
 void AttributeStoreComponent::setAttribute(std::string key, std::string value)
 {
 	setValue(key, value);
+	notifyAttributeChanged(key);
+}
+
+void AttributeStoreComponent::notifyAttributeChanged(const std::string& key)
+{
+	_changedAttribute = &key;
 	notifyObservers();
+	_changedAttribute = nullptr;
 }
 
 void AttributeStoreComponent::setOrAddAttribute(std::string key, float value)
@@ -526,26 +530,27 @@ std::vector<AttributeAffector> AttributeStoreComponent::getAttributeAffectorHist
 	return h;
 }
 
-void AttributeStoreComponent::serDes(SerDesBase& s)
-{
-	s.serDes(*static_cast<KeyValueStore*>(this));
-	s.serDes(*this);
-}
-
 ////////////////////////////////////////////////////////////
 
 World::World(const WorldMap& wm): _map{wm}, _entManager{ObjStaticID::FIRSTFREE}
 {
-	_entManager.registerComponentType<BodyComponent>(ComponentType::Body);
-	_entManager.registerComponentType<SphereGraphicsComponent>(ComponentType::GraphicsSphere);
-	_entManager.registerComponentType<MeshGraphicsComponent>(ComponentType::GraphicsMesh);
-	_entManager.registerComponentType<ParticleSystemGraphicsComponent>(ComponentType::GraphicsParticleSystem);
-	_entManager.registerComponentType<CollisionComponent>(ComponentType::Collision);
-	_entManager.registerComponentType<WizardComponent>(ComponentType::Wizard);
-	_entManager.registerComponentType<AttributeStoreComponent>(ComponentType::AttributeStore);
+	registerComponent<BodyComponent>(ComponentType::Body);
+	registerComponent<SphereGraphicsComponent>(ComponentType::GraphicsSphere);
+	registerComponent<MeshGraphicsComponent>(ComponentType::GraphicsMesh);
+	registerComponent<ParticleSystemGraphicsComponent>(ComponentType::GraphicsParticleSystem);
+	registerComponent<CollisionComponent>(ComponentType::Collision);
+	registerComponent<WizardComponent>(ComponentType::Wizard);
+	registerComponent<AttributeStoreComponent>(ComponentType::AttributeStore);
 	_entManager.addObserver(*this);
 }
 
+template <typename ComponentClass>
+void World::registerComponent(ComponentType t)
+{
+	_entManager.registerComponentType<ComponentClass>(t);
+	registerComponentCodec<ComponentClass>(t);
+}
+
 ID World::createEntity(ID hintEntID)
 {
 	ID eID = _entManager.createEntity(hintEntID);
@@ -577,7 +582,7 @@ ID World::createCharacter(vec3f position)
 	Entity& e = *getEntity(eID);
 
 	e.addComponent<MeshGraphicsComponent>("ninja.b3d", true, vec3f(0), vec3f(0,90,0), vec3f(0.2));
-	e.addComponent<CollisionComponent>(0.4, 1, vec3f(0, -0.9, 0), 80);
+	e.addComponent<CollisionComponent>(0.4, 1, vec3f(0, -0.9, 0), 80, false, -10, CollisionLayer::Character, CollisionLayer::All);
 	e.addComponent<WizardComponent>();
 	e.addComponent<AttributeStoreComponent>();
 	e.addComponent<BodyComponent>(position);
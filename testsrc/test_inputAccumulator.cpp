@@ -0,0 +1,82 @@
+#include <inputAccumulator.hpp>
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static Command yAngle(float a)
+{
+	Command c(Command::Type::Y_ANGLE_SET);
+	c._float = a;
+	return c;
+}
+
+static Command strafe(float x)
+{
+	Command c(Command::Type::STRAFE_DIR_SET);
+	c._vec2f = vec2f(x, 0);
+	return c;
+}
+
+// type and the float / strafe X of the applied commands
+static vector<pair<Command::Type, float>> flush(InputAccumulator& a)
+{
+	vector<pair<Command::Type, float>> v;
+	a.flush([&v](Command& c) {
+			v.push_back(make_pair(c._type, c._type == Command::Type::STRAFE_DIR_SET ? c._vec2f.X : c._float));
+		});
+	return v;
+}
+
+TEST(InputAccumulator, empty) {
+	InputAccumulator a;
+	ASSERT_TRUE(flush(a).empty());
+}
+
+TEST(InputAccumulator, stateMerged) {
+	InputAccumulator a;
+	a.add(yAngle(1));
+	a.add(strafe(1));
+	a.add(yAngle(2));
+	a.add(strafe(-1));
+	a.add(yAngle(3));
+	auto v = flush(a);
+	ASSERT_EQ(v.size(), 2u);
+	ASSERT_EQ(v[0], make_pair(Command::Type::Y_ANGLE_SET, 3.f));
+	ASSERT_EQ(v[1], make_pair(Command::Type::STRAFE_DIR_SET, -1.f));
+	ASSERT_EQ(a.takeMergedC(), 3u);
+	ASSERT_EQ(a.takeMergedC(), 0u);
+	ASSERT_TRUE(flush(a).empty());
+}
+
+TEST(InputAccumulator, oneShotKeepsItsAim) {
+	InputAccumulator a;
+	a.add(yAngle(1));
+	a.add(yAngle(2));
+	Command launch(Command::Type::LAUNCH_SPELL);
+	launch._float = 45;
+	a.add(launch);
+	a.add(yAngle(3));
+	a.add(yAngle(4));
+	auto v = flush(a);
+	ASSERT_EQ(v.size(), 3u);
+	ASSERT_EQ(v[0], make_pair(Command::Type::Y_ANGLE_SET, 2.f));
+	ASSERT_EQ(v[1], make_pair(Command::Type::LAUNCH_SPELL, 45.f));
+	ASSERT_EQ(v[2], make_pair(Command::Type::Y_ANGLE_SET, 4.f));
+}
+
+TEST(InputAccumulator, oneShotsLimited) {
+	InputAccumulator a(2);
+	Command launch(Command::Type::LAUNCH_SPELL);
+	for(int i = 0; i < 3; ++i) {
+		launch._float = i;
+		ASSERT_EQ(a.add(launch), i < 2);
+	}
+	// the state commands are never dropped
+	ASSERT_TRUE(a.add(yAngle(1)));
+	auto v = flush(a);
+	ASSERT_EQ(v.size(), 3u);
+	ASSERT_EQ(v[1], make_pair(Command::Type::LAUNCH_SPELL, 1.f));
+	ASSERT_EQ(a.takeDroppedC(), 1u);
+	// the limit is per flush
+	ASSERT_TRUE(a.add(launch));
+}
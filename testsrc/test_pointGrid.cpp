@@ -0,0 +1,96 @@
+#include <pointGrid.hpp>
+#include <algorithm>
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static vector<unsigned> inRadius(PointGrid<unsigned>& g, float x, float y, float z, float r)
+{
+	vector<unsigned> v;
+	g.queryRadius(x, y, z, r, [&v](unsigned k, float) { v.push_back(k); });
+	sort(v.begin(), v.end());
+	return v;
+}
+
+static vector<unsigned> nearest(PointGrid<unsigned>& g, float x, float y, float z, size_t k)
+{
+	vector<unsigned> v;
+	g.nearest(x, y, z, k, [](unsigned) { return true; }, v);
+	return v;
+}
+
+TEST(PointGrid, empty) {
+	PointGrid<unsigned> g;
+	ASSERT_TRUE(inRadius(g, 0, 0, 0, 100).empty());
+	ASSERT_TRUE(nearest(g, 0, 0, 0, 3).empty());
+	ASSERT_EQ(g.size(), 0u);
+}
+
+TEST(PointGrid, radius) {
+	PointGrid<unsigned> g(1);
+	g.set(1, 0, 0, 0);
+	g.set(2, 3, 0, 0);
+	g.set(3, 0, 5, 0);
+	ASSERT_EQ(inRadius(g, 0, 0, 0, 1), vector<unsigned>{1});
+	ASSERT_EQ(inRadius(g, 0, 0, 0, 3), (vector<unsigned>{1, 2}));
+	// the distance is 3D, the grid is over X and Z only
+	ASSERT_EQ(inRadius(g, 0, 0, 0, 5), (vector<unsigned>{1, 2, 3}));
+	ASSERT_EQ(inRadius(g, -2.5, 0, -2.5, 1), vector<unsigned>{});
+}
+
+TEST(PointGrid, moveAndRemove) {
+	PointGrid<unsigned> g(1);
+	g.set(1, 0, 0, 0);
+	g.set(2, 0.5, 0, 0.5);
+	g.set(1, 10, 0, 10);
+	ASSERT_EQ(g.size(), 2u);
+	ASSERT_EQ(inRadius(g, 0, 0, 0, 1), vector<unsigned>{2});
+	ASSERT_EQ(inRadius(g, 10, 0, 10, 1), vector<unsigned>{1});
+	g.remove(2);
+	g.remove(2);
+	ASSERT_FALSE(g.contains(2));
+	ASSERT_EQ(g.size(), 1u);
+	ASSERT_TRUE(inRadius(g, 0, 0, 0, 1).empty());
+	g.set(2, -0.5, 0, -0.5);
+	ASSERT_EQ(inRadius(g, 0, 0, 0, 1), vector<unsigned>{2});
+}
+
+TEST(PointGrid, nearestOrder) {
+	PointGrid<unsigned> g(2);
+	g.set(1, 9, 0, 0);
+	g.set(2, 1, 0, 0);
+	g.set(3, -4, 0, 0);
+	g.set(4, 0, 0, 20);
+	ASSERT_EQ(nearest(g, 0, 0, 0, 1), vector<unsigned>{2});
+	ASSERT_EQ(nearest(g, 0, 0, 0, 3), (vector<unsigned>{2, 3, 1}));
+	ASSERT_EQ(nearest(g, 0, 0, 0, 10), (vector<unsigned>{2, 3, 1, 4}));
+	// the closest by distance, not by the ring of cells
+	g.set(5, 1.9, 0, 1.9);
+	g.set(6, 2.1, 0, 0);
+	ASSERT_EQ(nearest(g, 1.9, 0, 0, 2), (vector<unsigned>{6, 2}));
+}
+
+TEST(PointGrid, nearestFiltered) {
+	PointGrid<unsigned> g(1);
+	for(unsigned i = 0; i < 10; ++i)
+		g.set(i, i, 0, 0);
+	vector<unsigned> v;
+	g.nearest(0, 0, 0, 2, [](unsigned k) { return k % 3 == 2; }, v);
+	ASSERT_EQ(v, (vector<unsigned>{2, 5}));
+}
+
+TEST(PointGrid, hugeAndInvalidQueries) {
+	PointGrid<unsigned> g(1);
+	g.set(1, 0, 0, 0);
+	g.set(2, 100, 0, 100);
+	ASSERT_EQ(inRadius(g, 0, 0, 0, 1e30), (vector<unsigned>{1, 2}));
+	ASSERT_EQ(inRadius(g, 0, 0, 0, INFINITY), (vector<unsigned>{1, 2}));
+	ASSERT_TRUE(inRadius(g, 0, 0, 0, NAN).empty());
+	ASSERT_TRUE(inRadius(g, 0, 0, 0, -5).empty());
+	ASSERT_TRUE(inRadius(g, NAN, 0, 0, 5).empty());
+	ASSERT_EQ(inRadius(g, 1e30, 0, 0, 1), vector<unsigned>{});
+	// far away from every point - not searched ring by ring
+	ASSERT_EQ(nearest(g, 1e9, 0, 1e9, 1), vector<unsigned>{2});
+	ASSERT_EQ(nearest(g, -1e30, 0, 0, 2), (vector<unsigned>{1, 2}));
+	ASSERT_TRUE(nearest(g, NAN, 0, 0, 1).empty());
+}
@@ -0,0 +1,91 @@
+#include <snapshotBuffer.hpp>
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static float lerp(const float& a, const float& b, float f)
+{
+	return a + (b-a)*f;
+}
+
+TEST(SnapshotBuffer, emptySample) {
+	SnapshotBuffer<float> b;
+	float out;
+	ASSERT_FALSE(b.sample(1, out, 0, lerp));
+}
+
+TEST(SnapshotBuffer, singleSample) {
+	SnapshotBuffer<float> b;
+	b.push(1, 10);
+	float out;
+	ASSERT_TRUE(b.sample(5, out, 1, lerp));
+	ASSERT_FLOAT_EQ(out, 10);
+}
+
+TEST(SnapshotBuffer, interpolate) {
+	SnapshotBuffer<float> b;
+	b.push(1, 10);
+	b.push(2, 20);
+	b.push(3, 40);
+	float out;
+	b.sample(1.5, out, 0, lerp);
+	ASSERT_FLOAT_EQ(out, 15);
+	b.sample(2.5, out, 0, lerp);
+	ASSERT_FLOAT_EQ(out, 30);
+}
+
+TEST(SnapshotBuffer, beforeOldest) {
+	SnapshotBuffer<float> b;
+	b.push(1, 10);
+	b.push(2, 20);
+	float out;
+	b.sample(0, out, 0, lerp);
+	ASSERT_FLOAT_EQ(out, 10);
+}
+
+TEST(SnapshotBuffer, extrapolateLimited) {
+	SnapshotBuffer<float> b;
+	b.push(1, 10);
+	b.push(2, 20);
+	float out;
+	b.sample(2.5, out, 1, lerp);
+	ASSERT_FLOAT_EQ(out, 25);
+	b.sample(10, out, 1, lerp);
+	ASSERT_FLOAT_EQ(out, 30);
+}
+
+TEST(SnapshotBuffer, dropReordered) {
+	SnapshotBuffer<float> b;
+	ASSERT_TRUE(b.push(2, 20));
+	ASSERT_FALSE(b.push(1, 10));
+	ASSERT_EQ(b.size(), 1);
+}
+
+TEST(SnapshotBuffer, overwriteOldest) {
+	SnapshotBuffer<float> b(3);
+	for(int i = 0; i < 5; i++)
+		b.push(i, i*10);
+	ASSERT_EQ(b.size(), 3);
+	ASSERT_FLOAT_EQ(b.oldestTime(), 2);
+	ASSERT_FLOAT_EQ(b.newestTime(), 4);
+	float out;
+	b.sample(3.5, out, 0, lerp);
+	ASSERT_FLOAT_EQ(out, 35);
+}
+
+TEST(ClockOffsetEstimator, leastDelayedWins) {
+	ClockOffsetEstimator e(0);
+	ASSERT_FALSE(e.hasEstimate());
+	e.addSample(100, 10.2);
+	e.addSample(101, 11.05);
+	e.addSample(102, 12.3);
+	ASSERT_TRUE(e.hasEstimate());
+	ASSERT_NEAR(e.toRemote(20), 109.95, 1e-3);
+}
+
+TEST(ClockOffsetEstimator, followsSlowly) {
+	ClockOffsetEstimator e(0.5);
+	e.addSample(100, 10);
+	e.addSample(101, 12);
+	ASSERT_NEAR(e.toRemote(0), 89.5, 1e-3);
+}
@@ -0,0 +1,109 @@
+#include <wire.hpp>
+#include "gtest/gtest.h"
+
+using namespace std;
+
+struct Point {
+	float x, y;
+	bool operator==(const Point& o) const { return x == o.x && y == o.y; }
+};
+
+template <>
+struct WirePod<Point>: std::true_type
+{};
+
+struct Record {
+	int i = 0;
+	float f = 0;
+	bool b = false;
+	Point p = {0, 0};
+	string s;
+	vector<unsigned> v;
+	vector<string> vs;
+	map<string, float> m;
+
+	template <typename T>
+		void doSerDes(T& t)
+		{
+			t & i;
+			t & f;
+			t & b;
+			t & p;
+			t & s;
+			t & v;
+			t & vs;
+			t & m;
+		}
+};
+
+static string encode(Record& r)
+{
+	WireSizer sz;
+	r.doSerDes(sz);
+	string buf(sz.size(), '\0');
+	WireWriter w(&buf[0]);
+	r.doSerDes(w);
+	EXPECT_EQ(w.written(), sz.size());
+	return buf;
+}
+
+static Record sample()
+{
+	Record r;
+	r.i = -42;
+	r.f = 3.5;
+	r.b = true;
+	r.p = {1, 2};
+	r.s = "hello";
+	r.v = {1, 2, 3};
+	r.vs = {"a", "", "bc"};
+	r.m = {{"health", 100}, {"mana", 0.5}};
+	return r;
+}
+
+TEST(Wire, size) {
+	Record r;
+	WireSizer sz;
+	r.doSerDes(sz);
+	ASSERT_EQ(sz.size(), sizeof(int)+sizeof(float)+sizeof(bool)+sizeof(Point)+4*sizeof(uint32_t));
+}
+
+TEST(Wire, roundTrip) {
+	Record r = sample();
+	string buf = encode(r);
+
+	Record d;
+	WireReader rd(buf.data(), buf.size());
+	d.doSerDes(rd);
+	ASSERT_TRUE(rd.ok());
+	ASSERT_TRUE(rd.atEnd());
+	ASSERT_EQ(d.i, r.i);
+	ASSERT_EQ(d.f, r.f);
+	ASSERT_EQ(d.b, r.b);
+	ASSERT_EQ(d.p, r.p);
+	ASSERT_EQ(d.s, r.s);
+	ASSERT_EQ(d.v, r.v);
+	ASSERT_EQ(d.vs, r.vs);
+	ASSERT_EQ(d.m, r.m);
+}
+
+TEST(Wire, truncated) {
+	Record r = sample();
+	string buf = encode(r);
+	for(size_t len = 0; len < buf.size(); len++) {
+		Record d;
+		WireReader rd(buf.data(), len);
+		d.doSerDes(rd);
+		ASSERT_FALSE(rd.ok()) << "length " << len;
+	}
+}
+
+TEST(Wire, corruptedCount) {
+	vector<unsigned> v;
+	uint32_t count = 1000000;
+	string buf(reinterpret_cast<char*>(&count), sizeof(count));
+	WireReader rd(buf.data(), buf.size());
+	rd & v;
+	ASSERT_FALSE(rd.ok());
+	ASSERT_TRUE(v.empty());
+}
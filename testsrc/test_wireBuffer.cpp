@@ -0,0 +1,67 @@
+#include <wireBuffer.hpp>
+#include <string>
+#include "gtest/gtest.h"
+
+using namespace std;
+
+TEST(WireBuffer, empty) {
+	WireBuffer b;
+	ASSERT_TRUE(b.empty());
+	ASSERT_EQ(b.data(), nullptr);
+	ASSERT_EQ(b.useCount(), 0);
+}
+
+TEST(WireBuffer, copy) {
+	BufferPool p;
+	string s = "hello";
+	WireBuffer b = p.copy(s.data(), s.size());
+	ASSERT_EQ(string(b.data(), b.size()), s);
+}
+
+TEST(WireBuffer, frame) {
+	BufferPool p;
+	string s(300, 'x');
+	WireBuffer b = p.frame(s.data(), s.size());
+	ASSERT_EQ(b.size(), s.size()+4);
+	ASSERT_EQ(b.data()[0], 0);
+	ASSERT_EQ(b.data()[1], 0);
+	ASSERT_EQ(b.data()[2], 1);
+	ASSERT_EQ(b.data()[3], 300-256);
+	ASSERT_EQ(string(b.data()+4, b.size()-4), s);
+}
+
+TEST(WireBuffer, shared) {
+	BufferPool p;
+	WireBuffer a = p.copy("abc", 3);
+	WireBuffer b = a;
+	ASSERT_EQ(a.useCount(), 2);
+	ASSERT_EQ(a.data(), b.data());
+	WireBuffer c = std::move(b);
+	ASSERT_EQ(a.useCount(), 2);
+	ASSERT_TRUE(b.empty());
+}
+
+TEST(BufferPool, reuse) {
+	BufferPool p;
+	const char* first;
+	{
+		WireBuffer a = p.copy("abc", 3);
+		first = a.data();
+		ASSERT_EQ(p.getFreeCount(), 0);
+	}
+	ASSERT_EQ(p.getFreeCount(), 1);
+	WireBuffer b = p.copy("xyz", 3);
+	ASSERT_EQ(b.data(), first);
+	ASSERT_EQ(p.getAllocatedCount(), 1);
+}
+
+TEST(BufferPool, maxFree) {
+	BufferPool p(1);
+	{
+		WireBuffer a = p.copy("a", 1);
+		WireBuffer b = p.copy("b", 1);
+		ASSERT_EQ(p.getAllocatedCount(), 2);
+	}
+	ASSERT_EQ(p.getFreeCount(), 1);
+	ASSERT_EQ(p.getAllocatedCount(), 1);
+}